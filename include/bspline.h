@@ -37,7 +37,8 @@ class BSpline : public Spline
 {
 public:
 
-    // Construct B-spline from knot vectors, control coefficients (assumed vectorized), and basis degrees
+    // Construct B-spline from knot vectors, control coefficients (assumed vectorized), and basis degrees.
+    // The coefficients have one row per output (see evalVector).
     //Bspline(std::vector<double> coefficients, std::vector<double> knotVectors, unsigned int basisDegrees);
     //Bspline(std::vector<double> coefficients, std::vector< std::vector<double> > knotVectors, std::vector<unsigned int> basisDegrees);
     BSpline(DenseMatrix coefficients, std::vector< std::vector<double> > knotVectors, std::vector<unsigned int> basisDegrees);
@@ -53,14 +54,27 @@ public:
 
     // Evaluation of B-spline
     double eval(DenseVector x) const;
-    DenseMatrix evalJacobian(DenseVector x) const;
+    double eval(const DenseVector &x, std::vector<int> &hint) const; // For sequences of nearby points, see bspline.cpp
+    DenseMatrix evalJacobian(DenseVector x) const; // numOutputs x n
     DenseMatrix evalHessian(DenseVector x) const;
 
+    // Evaluation of all outputs of a B-spline with several outputs (see getNumOutputs)
+    DenseVector evalVector(DenseVector x) const;
+
+    // Evaluates the value, and up to the given order (0, 1 or 2) the Jacobian (1 x n) and the Hessian (n x n), at x
+    void evalAll(const DenseVector &x, double &value, DenseMatrix &jacobian, DenseMatrix &hessian, unsigned int order = 2) const;
+
+    // Batch evaluation (vectorized over points when supported by the CPU)
+    void evalBatch(const DenseMatrix &X, DenseVector &y) const override;
+    void evalJacobianBatch(const DenseMatrix &X, DenseMatrix &J) const override; // Row i holds the Jacobian at point i, column by column
+
     // Getters
     unsigned int getNumVariables() const { return numVariables; }
+    unsigned int getNumOutputs() const { return coefficients.rows(); }
     unsigned int getNumControlPoints() const { return coefficients.cols(); }
 
     std::vector< std::vector<double> > getKnotVectors() const;
+    std::vector<unsigned int> getBasisDegrees() const;
 
     std::vector<double> getDomainUpperBound() const;
     std::vector<double> getDomainLowerBound() const;
@@ -74,11 +88,29 @@ public:
     bool reduceDomain(std::vector<double> lb, std::vector<double> ub, bool doRegularizeKnotVectors = true, bool doRefineKnotVectors = false);
 
     bool insertKnots(double tau, unsigned int dim, unsigned int multiplicity = 1); // TODO: move back to private
+    bool insertKnots(const std::vector<double> &tau, unsigned int dim);             // Several knots (possibly repeated) in dimension dim
+    bool insertKnots(const std::vector< std::vector<double> > &tau);                // Knots tau.at(dim) in each dimension dim
+
+    // Knot removal (Lyche-Morken): removes knots dimension by dimension while the maximum error of each output stays
+    // below tolerance, and returns the smaller B-spline. compressionRatio is set to the number of control points of
+    // this B-spline divided by that of the returned one.
+    BSpline removeKnots(double tolerance) const;
+    BSpline removeKnots(double tolerance, double &compressionRatio) const;
+
+    // Bounds of each output over the box [lb, ub] from the coefficients of the basis functions that are nonzero on the box
+    // (convex hull property). With tighten, they are the bounds from the control points of the B-spline reduced to the box,
+    // computed by local knot insertion without copying the B-spline.
+    void bounds(const std::vector<double> &lb, const std::vector<double> &ub, DenseVector &lower, DenseVector &upper, bool tighten = false) const;
+
+    // Bounds over many boxes in parallel: box i has the corners in row i of LB and UB, and its bounds in row i of lower and upper
+    void boundsBatch(const DenseMatrix &LB, const DenseMatrix &UB, DenseMatrix &lower, DenseMatrix &upper, bool tighten = false) const;
 
 protected:
 
     BSpline() {}
 
+    friend class BSplineView; // Shares the basis and control points (see bsplineview.h)
+
     BSplineBasis basis;
     DenseMatrix knotaverages; // One row per input
     DenseMatrix coefficients; // One row per output
@@ -88,8 +120,6 @@ protected:
     // Control point computations
     void computeKnotAverages();
     virtual void computeControlPoints(const DataTable &samples);
-    void computeBasisFunctionMatrix(const DataTable &samples, SparseMatrix &A) const;
-    void controlPointEquationRHS(const DataTable &samples, DenseMatrix &Bx, DenseMatrix &By) const;
 
 private:
 
@@ -100,8 +130,32 @@ private:
     // Knot insertion and refinement
     bool refineKnotVectors(); // All knots in one shabang
 
+    // Multiplies the control points along dimension dim by the univariate knot insertion matrix A.
+    // sizes holds the number of control points in each dimension, and is updated.
+    void transformControlPoints(const SparseMatrix &A, unsigned int dim, std::vector<unsigned int> &sizes);
+    std::vector<unsigned int> numBasisFunctionsPerDimension() const;
+
+    // Knot removal in dimension dim of the coefficient tensors in the columns of X (see removeKnots).
+    // X, sizes and knots are updated, and the bound on the change of the B-spline is returned.
+    static double removeKnots(DenseMatrix &X, std::vector<unsigned int> &sizes, std::vector<double> &knots, unsigned int degree, unsigned int dim, double tolerance);
+
+    // Significance of the interior knots (indices degree+1, ..., n-1) in dimension dim, from the jumps of the derivative of order degree
+    static std::vector<double> knotWeights(const DenseMatrix &X, const std::vector<unsigned int> &sizes, const std::vector<double> &knots, unsigned int degree, unsigned int dim);
+
+    // Least squares approximation Y of X in dimension dim on the knot vector without the knots at the indices removed.
+    // Returns the largest change of a coefficient when Y is expressed on the old knots again.
+    static double approximateWithoutKnots(const DenseMatrix &X, const std::vector<unsigned int> &sizes, const std::vector<double> &knots, unsigned int degree, unsigned int dim,
+                                          const std::vector<unsigned int> &removed, DenseMatrix &Y, std::vector<double> &coarseKnots);
+
+    // Returns the columns of M (one per control point) of the sub-tensor with index range [first, first+count) in each dimension
+    static DenseMatrix selectSubTensor(const DenseMatrix &M, const std::vector<unsigned int> &sizes, const std::vector<unsigned int> &first, const std::vector<unsigned int> &count);
+
+    // Calls body(start, run) for each run of count.back() consecutive columns of the sub-tensor, where start is the first column
+    template<class Body>
+    static void forEachSubTensorRun(const std::vector<unsigned int> &sizes, const std::vector<unsigned int> &first, const std::vector<unsigned int> &count, Body body);
+
     // Helper functions
-    bool pointInDomain(DenseVector x) const;
+    bool pointInDomain(const DenseVector &x) const;
 
 };
 
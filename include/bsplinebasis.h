@@ -32,13 +32,32 @@ public:
     DenseMatrix evalBasisJacobianOld(DenseVector &x) const; // Depricated
     SparseMatrix evalBasisHessian(DenseVector &x) const;
 
-    // Knot insertion
+    // Local evaluation: only the basis functions supported at x are evaluated,
+    // and they are contracted directly with the coefficients (no tensor basis vector is formed)
+    unsigned int numSupportedValues() const;
+    void evalSupported(const DenseVector &x, int *first, double *values, bool useHints = false) const; // With useHints, first holds the result for a nearby point on input
+    double contractSupported(const int *first, const double *values, const double *coefficients) const;
+    void evalSupportedDerivatives(const DenseVector &x, unsigned int order, int *first, double *table) const;
+    void contractSupportedDerivatives(const int *first, const double *table, unsigned int order, const double *coefficients, double &value, double *gradient, double *hessian) const;
+
+    // As above, for B-splines with numOutputs outputs (coefficients of the outputs stored consecutively per basis function)
+    void contractSupported(const int *first, const double *values, const double *coefficients, unsigned int numOutputs, double *y) const;
+    void contractSupportedJacobian(const int *first, const double *table, const double *coefficients, unsigned int numOutputs, double *y, double *jacobian) const;
+
+    // Local evaluation at the points in rows [begin, end) of X, with results written to y[begin], ..., y[end-1].
+    // Vectorized over groups of points when the CPU supports it. Assumes that all points are inside the support.
+    void contractBatch(const DenseMatrix &X, unsigned int begin, unsigned int end, const double *coefficients, double *y) const;
+
+    // Knot insertion, with the multivariate knot insertion matrix A
     bool refineKnots(SparseMatrix &A);
     bool insertKnots(SparseMatrix &A, double tau, unsigned int dim, unsigned int multiplicity = 1);
-    //bool insertKnots(SparseMatrix &A, std::vector<std::tuple<double,int,int>> tau, unsigned int dim, unsigned int multiplicity = 1);
+
+    // Knot insertion, with the univariate knot insertion matrices (one per dimension, or Adim for dimension dim)
+    bool refineKnots(std::vector<SparseMatrix> &A);
+    bool insertKnots(SparseMatrix &Adim, const std::vector<double> &tau, unsigned int dim);
 
     // Getters
-    BSplineBasis1D getSingleBasis(int dim);
+    BSplineBasis1D getSingleBasis(int dim) const;
     std::vector< std::vector<double> > getKnotVectors() const;
     std::vector<double> getKnotVector(int dim) const;
 
@@ -54,14 +73,21 @@ public:
     std::vector<int> getTensorIndexDimensionTarget() const;
     int supportedPrInterval() const;
 
-    bool insideSupport(DenseVector &x) const;
+    bool insideSupport(const DenseVector &x) const;
     std::vector<double> getSupportLowerBound() const;
     std::vector<double> getSupportUpperBound() const;
 
     // Support related
-    bool reduceSupport(std::vector<double>& lb, std::vector<double>& ub, SparseMatrix &A);
+    bool reduceSupport(std::vector<double>& lb, std::vector<double>& ub, SparseMatrix &A); // Selection matrix A
+    bool reduceSupport(const std::vector<double> &lb, const std::vector<double> &ub, std::vector<unsigned int> &first, std::vector<unsigned int> &count);
+
+    // Index range [first, first+count) of the basis functions that are nonzero on [lb, ub], in each dimension
+    void indexSupportedBasisFunctions(const std::vector<double> &lb, const std::vector<double> &ub, std::vector<unsigned int> &first, std::vector<unsigned int> &count) const;
+    bool buildRestrictionMatrix(SparseMatrix &R, double lb, double ub, unsigned int first, unsigned int count, unsigned int dim) const; // See BSplineBasis1D
 
 private:
+    void contractBatchScalar(const DenseMatrix &X, unsigned int begin, unsigned int end, const double *coefficients, double *y) const;
+
     std::vector<BSplineBasis1D> bases;
     unsigned int numVariables;
 };
@@ -32,22 +32,30 @@ public:
 
     // Evaluation of basis functions
     SparseVector evaluate(double x) const;
+    int evaluateNonzero(double x, double *values, int firstHint = -1) const; // Writes the degree+1 nonzero basis values to values, returns index of the first
+    int evaluateNonzeroDerivatives(double x, unsigned int order, double *derivatives) const; // As evaluateNonzero, for derivatives 0, ..., order
     SparseVector evaluateDerivative(double x, int r) const;
     DenseVector evaluateFirstDerivative(double x) const; // Depricated
 
     // Knot vector related
     bool refineKnots(SparseMatrix &A);
+    bool refineKnots(SparseMatrix &A, unsigned int numBasisFunctions); // Bisects the longest knot intervals until there are numBasisFunctions basis functions
     bool insertKnots(SparseMatrix &A, double tau, unsigned int multiplicity = 1);
-    // bool insertKnots(SparseMatrix &A, std::vector<tuple<double,int>> newKnots); // Add knots at several locations
+    bool insertKnots(SparseMatrix &A, const std::vector<double> &newKnots); // Add knots at several locations at once
     unsigned int knotMultiplicity(double tau) const; // Returns the number of repetitions of tau in the knot vector
 
     // Support related
     void supportHack(double &x) const;
     bool insideSupport(double x) const;
     bool reduceSupport(double lb, double ub, SparseMatrix &A);
+    bool reduceSupport(double lb, double ub, unsigned int &first, unsigned int &numRetained); // Retained basis functions first, ..., first+numRetained-1
+
+    // Matrix R that maps the coefficients of basis functions first, ..., first+count-1 (those nonzero on [lb, ub]) to the
+    // coefficients of the basis reduced to [lb, ub], as by knot insertion and reduceSupport, without changing this basis
+    bool buildRestrictionMatrix(SparseMatrix &R, double lb, double ub, unsigned int first, unsigned int count) const;
 
     // Getters
-    std::vector<double> getKnotVector() const { return knots; }
+    const std::vector<double> &getKnotVector() const { return knots; }
     unsigned int getBasisDegree() const { return degree; }
     double getKnotValue(unsigned int index) const;
     unsigned int numBasisFunctions() const;
@@ -56,6 +64,8 @@ public:
     // Index getters
     std::vector<int> indexSupportedBasisfunctions(double x) const;
     int indexHalfopenInterval(double x) const;
+    int indexHalfopenInterval(double x, int hint) const; // Checks the interval hint and its neighbours before searching
+    void indexHalfopenIntervals(const std::vector<double> &x, std::vector<int> &indices) const; // Fast for sorted x
     unsigned int indexLongestInterval() const;
     unsigned int indexLongestInterval(const std::vector<double> &vec) const;
 
@@ -63,6 +73,7 @@ private:
 
     // DeBoorCox algorithm for evaluating basis functions
     double deBoorCox(double x, int i, int k) const;
+    void deBoorCoxTriangular(double x, int u, double *values) const;
     double deBoorCoxCoeff(double x, double x_min, double x_max) const;
 
     // Builds basis matrix for alternative evaluation of basis functions
@@ -83,10 +94,20 @@ private:
     std::vector<double> knotVectorRegular(std::vector<double>& X) const;
     std::vector<double> knotVectorFree(std::vector<double>& X) const;
 
+    // Detects uniformly spaced knots, for which the knot interval of x is computed directly
+    void initIntervalLookup();
+
     // Member variables
     unsigned int degree;
     std::vector<double> knots;
     unsigned int targetNumBasisfunctions;
+
+    // Uniform knots: knots(uniformFirst), ..., knots(uniformLast) are distinct and equally spaced,
+    // and all other knots equal knots.front() or knots.back()
+    bool uniformKnots;
+    int uniformFirst;
+    int uniformLast;
+    double uniformInverseSpacing;
 };
 
 } // namespace MultivariateSplines
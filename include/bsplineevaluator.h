@@ -0,0 +1,231 @@
+/*
+ * This file is part of the Multivariate Splines library.
+ * Copyright (C) 2012 Bjarne Grimstad (bjarne.grimstad@gmail.com)
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+
+#ifndef MS_BSPLINEEVALUATOR_H
+#define MS_BSPLINEEVALUATOR_H
+
+#include "bspline.h"
+
+#include <array>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <type_traits>
+
+namespace MultivariateSplines
+{
+
+/*
+ * Evaluator for a B-spline with the number of variables (Dim) and the
+ * basis degree in all variables (Degree) fixed at compile time.
+ * The evaluator is built from an existing BSpline and takes a copy of its knot
+ * vectors and coefficients. All temporaries have fixed size and are kept on the
+ * stack, and all loops over variables and basis functions have compile-time
+ * trip counts, so that eval and evalJacobian can be unrolled and inlined.
+ * The evaluator is not updated if the B-spline is changed later.
+ *
+ * Example: BSplineEvaluator<2,3> evaluator(bspline); double y = evaluator.eval(x);
+ */
+template<unsigned int Dim, unsigned int Degree>
+class BSplineEvaluator
+{
+public:
+    typedef Eigen::Matrix<double, Dim, 1> Point;
+    typedef Eigen::Matrix<double, 1, Dim> Jacobian;
+
+    BSplineEvaluator(const BSpline &bspline)
+    {
+        static_assert(Dim > 0 && Degree > 0, "BSplineEvaluator: Dim and Degree must be positive.");
+
+        if(bspline.getNumVariables() != Dim)
+        {
+            throw Exception("BSplineEvaluator::BSplineEvaluator: Number of variables does not match the template parameter.");
+        }
+
+        if(bspline.getNumOutputs() != 1)
+        {
+            throw Exception("BSplineEvaluator::BSplineEvaluator: B-splines with several outputs are not supported.");
+        }
+
+        std::vector<unsigned int> degrees = bspline.getBasisDegrees();
+        for(unsigned int dim = 0; dim < Dim; dim++)
+        {
+            if(degrees.at(dim) != Degree)
+            {
+                throw Exception("BSplineEvaluator::BSplineEvaluator: Basis degree does not match the template parameter.");
+            }
+        }
+
+        std::vector< std::vector<double> > knotVectors = bspline.getKnotVectors();
+        for(unsigned int dim = 0; dim < Dim; dim++)
+        {
+            knots[dim] = knotVectors.at(dim);
+        }
+
+        // Strides of the coefficient tensor (the last variable varies fastest)
+        stride[Dim-1] = 1;
+        for(unsigned int dim = Dim-1; dim > 0; dim--)
+        {
+            stride[dim-1] = stride[dim]*(knots[dim].size() - Degree - 1);
+        }
+
+        DenseMatrix controlPoints = bspline.getControlPoints();
+        coefficients.resize(controlPoints.cols());
+        for(unsigned int i = 0; i < coefficients.size(); i++)
+        {
+            coefficients[i] = controlPoints(Dim, i);
+        }
+    }
+
+    double eval(const Point &x) const
+    {
+        std::array<int, Dim> first;
+        std::array<BasisValues, Dim> values;
+        std::array<const double*, Dim> tables;
+
+        for(unsigned int dim = 0; dim < Dim; dim++)
+        {
+            first[dim] = evalBasis(dim, x(dim), values[dim].data());
+            tables[dim] = values[dim].data();
+        }
+
+        return contract(first, tables, 0, std::integral_constant<unsigned int, 0>());
+    }
+
+    // Returns the (1 x Dim) Jacobian evaluated at x
+    Jacobian evalJacobian(const Point &x) const
+    {
+        std::array<int, Dim> first;
+        std::array<BasisValues, Dim> values;
+        std::array<BasisValues, Dim> derivatives;
+        std::array<const double*, Dim> tables;
+
+        for(unsigned int dim = 0; dim < Dim; dim++)
+        {
+            first[dim] = evalBasisDerivative(dim, x(dim), values[dim].data(), derivatives[dim].data());
+            tables[dim] = values[dim].data();
+        }
+
+        // Partial derivative i: differentiated basis in dimension i
+        Jacobian jacobian;
+        for(unsigned int i = 0; i < Dim; i++)
+        {
+            tables[i] = derivatives[i].data();
+            jacobian(i) = contract(first, tables, 0, std::integral_constant<unsigned int, 0>());
+            tables[i] = values[i].data();
+        }
+
+        return jacobian;
+    }
+
+private:
+    typedef std::array<double, Degree+1> BasisValues;
+
+    std::array<std::vector<double>, Dim> knots;
+    std::array<int, Dim> stride;
+    std::vector<double> coefficients;
+
+    // Returns the knot index u such that knots(u) <= x < knots(u+1) (see BSplineBasis1D::indexHalfopenInterval)
+    int indexHalfopenInterval(unsigned int dim, double &x) const
+    {
+        const std::vector<double> &t = knots[dim];
+
+        if(!(t.front() <= x && x <= t.back()))
+        {
+            throw Exception("BSplineEvaluator::eval: Evaluation at point outside domain.");
+        }
+
+        // Move x at the right boundary into the half-open domain
+        if(x == t.back())
+        {
+            x = std::nextafter(x, std::numeric_limits<double>::lowest());
+        }
+
+        return std::upper_bound(t.begin(), t.end(), x) - t.begin() - 1;
+    }
+
+    // Raises the nonzero basis values from degree j-1 to degree j (see BSplineBasis1D::deBoorCoxTriangular)
+    static void raiseDegree(const double *t, int u, unsigned int j, double x, double *values)
+    {
+        double saved = 0;
+        for(unsigned int r = 0; r < j; r++)
+        {
+            double tRight = t[u+r+1];
+            double tLeft = t[u+r+1-j];
+            double temp = values[r]/(tRight - tLeft);
+            values[r] = saved + (tRight - x)*temp;
+            saved = (x - tLeft)*temp;
+        }
+        values[j] = saved;
+    }
+
+    // Evaluates the Degree+1 nonzero basis functions at x and returns the index of the first
+    int evalBasis(unsigned int dim, double x, double *values) const
+    {
+        int u = indexHalfopenInterval(dim, x);
+        const double *t = knots[dim].data();
+
+        values[0] = 1;
+        for(unsigned int j = 1; j <= Degree; j++)
+        {
+            raiseDegree(t, u, j, x, values);
+        }
+
+        return u - Degree;
+    }
+
+    // As evalBasis, but also computes the first derivatives of the basis functions
+    int evalBasisDerivative(unsigned int dim, double x, double *values, double *derivatives) const
+    {
+        int u = indexHalfopenInterval(dim, x);
+        const double *t = knots[dim].data();
+
+        values[0] = 1;
+        for(unsigned int j = 1; j < Degree; j++)
+        {
+            raiseDegree(t, u, j, x, values);
+        }
+
+        // Derivative from the basis of degree p-1 (Equation 3.35 in Lyche & Moerken (2011))
+        double previous = 0;
+        for(unsigned int r = 0; r < Degree; r++)
+        {
+            double temp = Degree*values[r]/(t[u+r+1] - t[u+r+1-Degree]);
+            derivatives[r] = previous - temp;
+            previous = temp;
+        }
+        derivatives[Degree] = previous;
+
+        raiseDegree(t, u, Degree, x, values);
+
+        return u - Degree;
+    }
+
+    // Sum over the supported basis functions in dimension D and higher, using tables[dim] as basis values
+    template<unsigned int D>
+    double contract(const std::array<int, Dim> &first, const std::array<const double*, Dim> &tables, int index, std::integral_constant<unsigned int, D>) const
+    {
+        double sum = 0;
+        for(unsigned int k = 0; k <= Degree; k++)
+        {
+            sum += tables[D][k]*contract(first, tables, index + (first[D] + k)*stride[D], std::integral_constant<unsigned int, D+1>());
+        }
+        return sum;
+    }
+
+    double contract(const std::array<int, Dim> &, const std::array<const double*, Dim> &, int index, std::integral_constant<unsigned int, Dim>) const
+    {
+        return coefficients[index];
+    }
+};
+
+} // namespace MultivariateSplines
+
+#endif // MS_BSPLINEEVALUATOR_H
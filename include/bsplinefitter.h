@@ -0,0 +1,121 @@
+/*
+ * This file is part of the Multivariate Splines library.
+ * Copyright (C) 2012 Bjarne Grimstad (bjarne.grimstad@gmail.com)
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+
+#ifndef MS_BSPLINEFITTER_H
+#define MS_BSPLINEFITTER_H
+
+#include "generaldefinitions.h"
+#include "datatable.h"
+#include "bspline.h"
+#include "pspline.h"
+#include "bsplinebasis.h"
+#include "linearsolvers.h"
+
+#include <set>
+#include <memory>
+
+namespace MultivariateSplines
+{
+
+/*
+ * Fits B-splines to samples on a fixed complete grid.
+ * The equations for the control coefficients are set up and factorized once, when the fitter
+ * is constructed. The fitter can then be used to fit B-splines to any number of sets of sample
+ * values on the same grid (e.g. in parameter sweeps or for time-varying tables), at the cost
+ * of a back-substitution per fit.
+ *
+ * The fitter either interpolates the samples (as BSpline(samples, type)), or computes the
+ * smoothing fit min |Bc - y|^2 + lambda*|Dc|^2 with a difference penalty matrix D (as PSpline).
+ * Sample values are ordered as the samples in a DataTable (lexicographically in x).
+ *
+ * With the second-order difference penalty of PSpline and one sample per grid point, the global
+ * matrices B and D are never formed: the equations are solved with a PenalizedKroneckerSolver,
+ * which only stores univariate matrices (see factorizeGLAM).
+ */
+class BSplineFitter
+{
+public:
+    BSplineFitter(const DataTable &samples, BSplineType type);  // Interpolating B-spline
+    BSplineFitter(const DataTable &samples, double lambda);     // Cubic P-spline with smoothing parameter lambda
+
+    // Interpolation, and penalized fit, with a given basis
+    BSplineFitter(const DataTable &samples, const BSplineBasis &basis);
+    BSplineFitter(const DataTable &samples, const BSplineBasis &basis, double lambda); // Second-order difference penalty, as PSpline
+    BSplineFitter(const DataTable &samples, const BSplineBasis &basis, const SparseMatrix &penalty, double lambda);
+
+    // Fits a B-spline to the sample values y. Each column of y gives an output of the B-spline,
+    // so that several quantities sampled on the same grid are fitted with one factorization.
+    BSpline refit(const DenseMatrix &y) const;
+
+    // Fits a B-spline to the sample values of samples, which must have the grid of the fitter
+    BSpline refit(const DataTable &samples) const;
+
+    // Returns the control coefficients (one column per column of y) for the sample values y
+    DenseMatrix solve(const DenseMatrix &y) const;
+
+    // Returns the values B*c at the samples of the B-splines with control coefficients c (one column per B-spline)
+    DenseMatrix fittedValues(const DenseMatrix &coefficients) const;
+
+    unsigned int getNumSamples() const { return numSamples; }
+
+    // The relative residual |A*c - b|/|b| of the equations is checked against the tolerance after each solve,
+    // unless disabled (as in LinearSolver). The tolerance is also the stopping criterion of the CG solver.
+    void setTolerance(double tolerance);
+    void setResidualCheck(bool check) { checkResidual = check; }
+
+    // Changes the smoothing parameter of a P-spline fitted without forming B and D (see factorizeGLAM), reusing
+    // the factorization. Returns false, and leaves the fitter unchanged, for other fitters, which must be set up again.
+    bool setLambda(double lambda);
+
+    // Returns the smoothing parameter of the P-spline with the second-order difference penalty on the given basis
+    // that minimizes the criterion for the samples (see bsplinefitter.cpp)
+    static double selectLambda(const DataTable &samples, const BSplineBasis &basis, SmoothingCriterion criterion);
+
+private:
+    BSplineBasis basis;
+    double lambda;
+    bool penalized;
+    bool differencePenalty; // The penalty is the second-order difference penalty of PSpline
+    unsigned int numSamples;
+    std::vector< std::set<double> > grid;
+
+    // Left-hand side of the equations (collocation matrix B for interpolation, B'B + lambda*D'D otherwise)
+    SparseMatrix lhs;
+    SparseMatrix collocation; // B, kept for the right-hand side B'y of a penalized fit
+
+    // Factorization of the left-hand side: one of the Kronecker solvers, or one of the others as given by solverType
+    std::shared_ptr<KroneckerSolver> kroneckerSolver;
+    std::shared_ptr<PenalizedKroneckerSolver> penalizedKroneckerSolver;
+    std::vector<SparseMatrix> univariateCollocation; // B_d, kept for the right-hand side of the penalized Kronecker solver
+    LinearSolverType solverType;
+    std::shared_ptr< Eigen::SparseLU<SparseMatrix> > sparseLU;
+    std::shared_ptr< Eigen::SparseQR<SparseMatrix, Eigen::COLAMDOrdering<int> > > sparseQR;
+    std::shared_ptr< Eigen::SimplicialLDLT<SparseMatrix> > sparseLDLT;
+    std::shared_ptr<PreconditionedCG> sparseCG;
+    std::shared_ptr< Eigen::ColPivHouseholderQR<DenseMatrix> > denseQR;
+
+    double tol = 1e-12; // Relative residual tolerance, as in LinearSolver
+    bool checkResidual = true;
+
+    void factorize(const DataTable &samples, const SparseMatrix *penalty);
+    bool factorizeKronecker(const DataTable &samples);
+    bool factorizeGLAM(const DataTable &samples);
+    bool computeUnivariateCollocationMatrices(const DataTable &samples, std::vector<SparseMatrix> &factors) const;
+    bool validSolution(const DenseMatrix &rhs, const DenseMatrix &c) const;
+    bool solveFactorized(const DenseMatrix &rhs, DenseMatrix &c) const; // Fallback when CG does not converge
+    static void computeBasisFunctionMatrix(const BSplineBasis &basis, const DataTable &samples, SparseMatrix &A);
+
+    // Computes (B_0 x ... x B_(n-1))*x, or its transpose times x, mode by mode with the univariate collocation matrices
+    DenseMatrix multiplyUnivariateCollocation(const DenseMatrix &x, bool transpose) const;
+};
+
+} // namespace MultivariateSplines
+
+#endif // MS_BSPLINEFITTER_H
@@ -0,0 +1,101 @@
+/*
+ * This file is part of the Multivariate Splines library.
+ * Copyright (C) 2012 Bjarne Grimstad (bjarne.grimstad@gmail.com)
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+
+#ifndef MS_BSPLINEMINIMIZER_H
+#define MS_BSPLINEMINIMIZER_H
+
+#include "generaldefinitions.h"
+#include "bspline.h"
+#include "bsplineview.h"
+
+namespace MultivariateSplines
+{
+
+/*
+ * Global minimization of a B-spline (with one output) over its domain by spatial branch-and-bound.
+ *
+ * Each node of the search tree is a box of the domain, held as a BSplineView. A node is bounded from below by
+ * the tightened control point bounds of the box (see BSpline::bounds), and from above by the value at a local
+ * minimizer, found by projected Newton iterations with evalJacobian and evalHessian from the best control point.
+ * Nodes whose lower bound is not below the best value found (the incumbent) minus the tolerance are pruned, and
+ * the others are split in two along their widest side.
+ *
+ * The nodes are processed best-first in rounds. The open nodes with the smallest lower bounds are taken from the
+ * queue, processed in parallel on the default ThreadPool (where idle threads steal chunks of nodes from busy ones),
+ * and merged into the queue in a fixed order. The result and the number of nodes therefore do not depend on the
+ * number of threads or on their scheduling.
+ *
+ * Example: BSplineMinimizer minimizer(bspline); minimizer.minimize(); DenseVector x = minimizer.getMinimizer();
+ */
+class BSplineMinimizer
+{
+public:
+    BSplineMinimizer(const BSpline &bspline);
+
+    void setTolerance(double tol) { this->tol = tol; }                          // Absolute optimality gap (default 1e-6)
+    void setMaxNodes(unsigned long maxNodes) { this->maxNodes = maxNodes; }     // Limit on processed nodes (default 10^6)
+    void setBatchSize(unsigned int batchSize) { this->batchSize = batchSize; }  // Nodes per round (default 64)
+    void setMinWidth(double minWidth) { this->minWidth = minWidth; }            // Boxes narrower than minWidth times the domain are not split (default 1e-9)
+
+    // Returns true if the optimality gap is closed to within the tolerance
+    bool minimize();
+
+    // Results
+    DenseVector getMinimizer() const { return minimizer; }
+    double getMinimum() const { return minimum; }
+    double getLowerBound() const { return lowerBound; }                     // Lower bound of the global minimum
+    unsigned long getNumNodes() const { return numNodes; }                  // Processed nodes
+    unsigned long getNumRounds() const { return numRounds; }
+    double getElapsedTime() const { return elapsedTime; }                   // Seconds
+    double getNodesPerSecond() const { return elapsedTime > 0 ? numNodes/elapsedTime : 0; }
+
+private:
+    BSplineView root;
+    std::vector<double> domainWidth;
+
+    double tol;
+    unsigned long maxNodes;
+    unsigned int batchSize;
+    double minWidth;
+
+    DenseVector minimizer;
+    double minimum;
+    double lowerBound;
+    unsigned long numNodes;
+    unsigned long numRounds;
+    double elapsedTime;
+
+    struct Node
+    {
+        BSplineView view;
+        double lowerBound;  // Of the parent before the node is processed
+        unsigned long id;   // Creation order, breaks ties between equal lower bounds
+    };
+
+    // Result of processing a node
+    struct NodeResult
+    {
+        double lowerBound;
+        double value;       // At x
+        DenseVector x;
+        bool split;         // Whether the node is wide enough to be split
+        unsigned int splitDim;
+        double splitPoint;
+    };
+
+    void processNode(const Node &node, NodeResult &result) const;
+
+    // Projected Newton iterations from x inside the box [lb, ub]. Returns the value at the final x.
+    double localMinimize(const BSplineView &view, DenseVector &x) const;
+};
+
+} // namespace MultivariateSplines
+
+#endif // MS_BSPLINEMINIMIZER_H
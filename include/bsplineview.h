@@ -0,0 +1,95 @@
+/*
+ * This file is part of the Multivariate Splines library.
+ * Copyright (C) 2012 Bjarne Grimstad (bjarne.grimstad@gmail.com)
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+
+#ifndef MS_BSPLINEVIEW_H
+#define MS_BSPLINEVIEW_H
+
+#include "generaldefinitions.h"
+#include "spline.h"
+#include "bspline.h"
+
+#include <memory>
+
+namespace MultivariateSplines
+{
+
+/*
+ * A B-spline restricted to a box [lb, ub] of its domain, e.g. for the nodes of a spatial branch-and-bound.
+ *
+ * A view shares the basis and control points of the B-spline it was created from by reference counting,
+ * and it only records the box and the index range of the basis functions that are nonzero on it. Views are
+ * therefore cheap to create and copy, and a view of a view shares the same storage. The B-spline is copied,
+ * and reduced to the box, only when a view is modified by knot insertion (copy-on-write). The B-spline of
+ * the other views is not affected.
+ *
+ * Example: BSplineView root(bspline); BSplineView node = root.subdomain(lb, ub); double y = node.eval(x);
+ */
+class BSplineView : public Spline
+{
+public:
+    BSplineView(const BSpline &bspline); // Copies bspline once into shared storage
+    BSplineView(std::shared_ptr<BSpline> bspline); // Shares bspline, which must not be modified afterwards
+
+    // Returns a view of the box [lb, ub], which must be inside the box of this view
+    BSplineView subdomain(const std::vector<double> &lb, const std::vector<double> &ub) const;
+
+    // Evaluation at points in the box
+    double eval(DenseVector x) const override;
+    DenseVector evalVector(DenseVector x) const;
+    DenseMatrix evalJacobian(DenseVector x) const override;
+    DenseMatrix evalHessian(DenseVector x) const override;
+
+    // Getters
+    unsigned int getNumVariables() const { return bspline->getNumVariables(); }
+    unsigned int getNumOutputs() const { return bspline->getNumOutputs(); }
+    unsigned int getNumControlPoints() const; // Number of basis functions that are nonzero on the box
+
+    std::vector<double> getDomainLowerBound() const { return lb; }
+    std::vector<double> getDomainUpperBound() const { return ub; }
+
+    // Index of the first basis function, and number of basis functions, that are nonzero on the box in each dimension
+    std::vector<unsigned int> getFirstIndex() const { return first; }
+    std::vector<unsigned int> getNumBasisFunctions() const { return count; }
+
+    // Returns the control points of the basis functions that are nonzero on the box (as BSpline::getControlPoints)
+    DenseMatrix getControlPoints() const;
+
+    // Bounds of each output over the box (see BSpline::bounds)
+    void bounds(DenseVector &lower, DenseVector &upper, bool tighten = false) const;
+
+    // Returns the shared B-spline, and whether other views share it
+    const BSpline &getBSpline() const { return *bspline; }
+    bool isShared() const { return bspline.use_count() > 1; }
+
+    // Returns a B-spline with the domain reduced to the box
+    BSpline toBSpline() const;
+
+    // Knot insertion (see BSpline::insertKnots). The view gets its own B-spline, reduced to the box, unless it
+    // already has one. On failure, the view is left unchanged.
+    bool insertKnots(const std::vector<double> &tau, unsigned int dim);
+    bool insertKnots(const std::vector< std::vector<double> > &tau);
+
+private:
+    std::shared_ptr<BSpline> bspline;
+    std::vector<double> lb, ub;
+    std::vector<unsigned int> first, count;
+
+    BSplineView(std::shared_ptr<BSpline> bspline, const std::vector<double> &lb, const std::vector<double> &ub);
+
+    bool insideDomain(const DenseVector &x) const;
+
+    // Returns a B-spline that may be modified: the shared B-spline if no other view shares it and the view is
+    // not restricted, and otherwise a copy reduced to the box
+    std::shared_ptr<BSpline> ownBSpline() const;
+};
+
+} // namespace MultivariateSplines
+
+#endif // MS_BSPLINEVIEW_H
@@ -34,6 +34,34 @@ typedef Eigen::SparseVector<double> SparseVector;
 typedef Eigen::MatrixXd DenseMatrix;
 typedef Eigen::SparseMatrix<double> SparseMatrix; // declares a column-major sparse matrix type of double
 
+/*
+ * Small array that is kept on the stack, unless the requested size
+ * exceeds stackSize, in which case the array is allocated on the heap.
+ * Used for temporaries in evaluation routines that should not allocate.
+ */
+template<typename T, unsigned int stackSize = 64>
+class StackBuffer
+{
+public:
+    StackBuffer(unsigned int size)
+        : heap(size > stackSize ? size : 0),
+          ptr(size > stackSize ? heap.data() : stack)
+    {
+    }
+
+    StackBuffer(const StackBuffer &) = delete;
+    StackBuffer &operator=(const StackBuffer &) = delete;
+
+    T *data() { return ptr; }
+    T &operator[](unsigned int i) { return ptr[i]; }
+    const T &operator[](unsigned int i) const { return ptr[i]; }
+
+private:
+    T stack[stackSize];
+    std::vector<T> heap;
+    T *ptr;
+};
+
 class Exception : public std::exception
 {
 private:
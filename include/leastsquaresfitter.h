@@ -0,0 +1,144 @@
+/*
+ * This file is part of the Multivariate Splines library.
+ * Copyright (C) 2012 Bjarne Grimstad (bjarne.grimstad@gmail.com)
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+
+#ifndef MS_LEASTSQUARESFITTER_H
+#define MS_LEASTSQUARESFITTER_H
+
+#include "generaldefinitions.h"
+#include "datatable.h"
+#include "bspline.h"
+#include "bsplinebasis.h"
+
+#include <memory>
+#include <Eigen/SparseCholesky>
+
+namespace MultivariateSplines
+{
+
+enum class LeastSquaresSolver
+{
+    CHOLESKY,   // Sparse Cholesky (LDLT) factorization of the normal equations
+    LSQR        // Iterative solution of the least squares problem, without forming the normal equations
+};
+
+/*
+ * Least squares fit of B-splines with a given basis (e.g. with explicit knot vectors) to scattered samples:
+ *   min |Bc - y|^2 + lambda*|Dc|^2,
+ * where B holds the basis functions evaluated at the samples and D is an optional penalty matrix.
+ * Unlike BSplineFitter, the samples need not lie on a grid, and there may be many more samples than basis functions.
+ *
+ * Each row of B has only (p+1)^n nonzeros, so B'B has at most (2p+1)^n nonzeros per row. With the Cholesky solver,
+ * B'B and B'y are accumulated in parallel by the default ThreadPool without forming B (see accumulateNormalEquations),
+ * and the normal equations are solved by a sparse LDLT factorization. The LSQR solver works on the least squares
+ * problem itself, computing products with B on the fly. It needs no memory for B'B and is more accurate for
+ * ill-conditioned problems, at the cost of a pass over the samples in each iteration.
+ *
+ * The fitter can also fit incrementally, to samples that arrive over time (see addSamples). The weighted sums
+ * B'*W*B and B'*W*y are then kept, and each new sample or mini-batch only updates the rows of its supported basis
+ * functions. Older samples can be forgotten exponentially. An updated fit costs a numeric factorization of the
+ * normal equations, which have a fixed sparsity pattern, so the symbolic factorization is computed only once.
+ *
+ * Example: LeastSquaresFitter fitter(BSplineBasis(knotVectors, degrees, KnotVectorType::EXPLICIT)); BSpline bspline = fitter.fit(X, y);
+ */
+class LeastSquaresFitter
+{
+public:
+    LeastSquaresFitter(const BSplineBasis &basis);
+    LeastSquaresFitter(const BSplineBasis &basis, double lambda); // Second-order difference penalty, as PSpline
+    LeastSquaresFitter(const BSplineBasis &basis, const SparseMatrix &penalty, double lambda);
+
+    void setSolver(LeastSquaresSolver solver) { this->solver = solver; }
+    void setTolerance(double tol) { this->tol = tol; }                                  // Relative tolerance of LSQR
+    void setMaxIterations(unsigned int maxIterations) { this->maxIterations = maxIterations; } // Iteration limit of LSQR
+
+    // Fits a B-spline to the points in the rows of X with values y. Each column of y gives an output of the B-spline.
+    BSpline fit(const DenseMatrix &X, const DenseMatrix &y) const;
+
+    // Fits a B-spline to samples (the grid may be incomplete)
+    BSpline fit(const DataTable &samples) const;
+
+    // Returns the control coefficients (one column per column of y)
+    DenseMatrix solve(const DenseMatrix &X, const DenseMatrix &y) const;
+
+    // Computes B'*B and B'*y for the points in the rows of X with values y
+    void computeNormalEquations(const DenseMatrix &X, const DenseMatrix &y, SparseMatrix &BtB, DenseMatrix &Bty) const;
+
+    // Incremental fit: adds the points in the rows of X with values y (and weights) to the accumulated normal equations.
+    // All samples must have the same number of outputs.
+    void addSamples(const DenseMatrix &X, const DenseMatrix &y);
+    void addSamples(const DenseMatrix &X, const DenseMatrix &y, const DenseVector &weights);
+
+    // With forgetting factor f in (0,1], the weight of a sample is multiplied by f for each sample added after it
+    void setForgettingFactor(double factor);
+
+    // Returns the control coefficients, or the B-spline, fitted to the accumulated samples (always with the Cholesky solver)
+    DenseMatrix solveAccumulated();
+    BSpline fitAccumulated();
+
+    void clearAccumulated();
+    unsigned long getNumAccumulatedSamples() const { return numAccumulated; }
+
+private:
+    BSplineBasis basis;
+    double lambda;
+    SparseMatrix penalty; // D, empty without penalty
+    SparseMatrix penaltyGram; // lambda*D'*D, empty without penalty
+    LeastSquaresSolver solver;
+    double tol;
+    unsigned int maxIterations;
+
+    /*
+     * Band storage of B'*B: row i holds the products of basis function i with the basis functions j >= i that are
+     * supported at the same points, i.e. with index offsets in [-p_d, p_d] in each dimension d. The offsets are
+     * numbered lexicographically (the last dimension varies fastest), and the nonnegative ones are stored.
+     */
+    unsigned int numVariables;
+    unsigned int numCoefficients;
+    unsigned int numSupported;              // (p+1)^n basis functions supported at a point
+    unsigned int numOffsets;                // (2p+1)^n offsets
+    unsigned int numSlots;                  // Stored (nonnegative) offsets per row
+    std::vector<int> stride;                // Coefficient strides
+    std::vector<int> localIndex;            // Index of the supported basis functions relative to the first
+    std::vector<unsigned int> pairStart;    // Pairs (a,b) of supported basis functions with b >= a, grouped by a
+    std::vector<unsigned int> pairOther;    // b of each pair
+    std::vector<unsigned int> pairSlot;     // Offset of b from a, in the band storage
+    std::vector<int> offsets;               // Offset in each dimension of each offset (numOffsets x numVariables)
+
+    // Accumulated samples. The sums are accumulatedScale times the stored sums, so that forgetting does not touch them.
+    double forgettingFactor;
+    double accumulatedScale;
+    unsigned long numAccumulated;
+    std::vector<double> accumulatedGram;
+    DenseMatrix accumulatedRhs;
+    std::shared_ptr< Eigen::SimplicialLDLT<SparseMatrix> > accumulatedLDLT; // Keeps the symbolic factorization
+
+    void init();
+    void setPenalty(const SparseMatrix &penalty, double lambda);
+    void checkSamples(const DenseMatrix &X, const DenseMatrix &y) const;
+    unsigned int numBlocks(unsigned int numSamples, size_t blockSize) const;
+
+    // Calls body(i, first, values) for the samples in rows [begin, end) of X, where first is the index of the first
+    // supported basis function and values holds the numSupported supported basis values (ordered as localIndex)
+    template<class Body>
+    void forEachSample(const DenseMatrix &X, unsigned int begin, unsigned int end, Body body) const;
+
+    // Adds B'*W*B and B'*W*y to gram and rhs (W = I for empty weights)
+    void accumulateNormalEquations(const DenseMatrix &X, const DenseMatrix &y, const DenseVector &weights, std::vector<double> &gram, DenseMatrix &rhs) const;
+    SparseMatrix assembleGramMatrix(const std::vector<double> &gram) const;
+    DenseMatrix solveNormalEquations(const std::vector<double> &gram, const DenseMatrix &rhs, double scale, Eigen::SimplicialLDLT<SparseMatrix> &ldlt, bool analyzePattern) const;
+
+    DenseMatrix solveLSQR(const DenseMatrix &X, const DenseMatrix &y) const;
+    DenseMatrix multiplyBasis(const DenseMatrix &X, const DenseMatrix &c) const;          // B*c
+    DenseMatrix multiplyBasisTranspose(const DenseMatrix &X, const DenseMatrix &r) const; // B'*r
+};
+
+} // namespace MultivariateSplines
+
+#endif // MS_LEASTSQUARESFITTER_H
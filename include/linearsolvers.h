@@ -14,6 +14,10 @@
 #include "generaldefinitions.h"
 #include "Eigen/IterativeLinearSolvers"
 #include "Eigen/SparseQR"
+#include "Eigen/SparseLU"
+#include "Eigen/SparseCholesky"
+#include "Eigen/Eigenvalues"
+#include <memory>
 
 namespace MultivariateSplines
 {
@@ -31,16 +35,23 @@ public:
 
         bool success = doSolve(A, b, x);
 
-        if (!(success && validSolution(A, b, x)))
+        if (!(success && (!checkResidual || validSolution(A, b, x))))
         {
             throw Exception("LinearSolver::solve: Solver did not converge to acceptable tolerance!");
         }
         return true;
     }
 
-private:
+    // The relative residual |A*x - b|/|b| is checked against the tolerance after each solve, unless disabled
+    void setTolerance(double tolerance) { tol = tolerance; }
+    void setResidualCheck(bool check) { checkResidual = check; }
+
+protected:
     double tol = 1e-12; // Relative error tolerance
 
+private:
+    bool checkResidual = true;
+
     virtual bool doSolve(const lhs &A, const rhs &b, rhs &x) const = 0;
 
     bool consistentData(const lhs &A, const rhs &b) const
@@ -143,6 +154,538 @@ private:
     }
 };
 
+class SparseLDLT : public LinearSolver<SparseMatrix, DenseMatrix>
+{
+private:
+    bool doSolve(const SparseMatrix &A, const DenseMatrix &b, DenseMatrix &x) const
+    {
+        // Init sparse LDLT solver (requires symmetric positive (semi-)definite matrices, only the lower triangle is used)
+        Eigen::SimplicialLDLT<SparseMatrix> sparseSolver(A);
+
+        if (sparseSolver.info() == Eigen::Success)
+        {
+            // Solve LSE
+            x = sparseSolver.solve(b);
+
+            return sparseSolver.info() == Eigen::Success;
+        }
+
+        return false;
+    }
+};
+
+typedef Eigen::ConjugateGradient<SparseMatrix, Eigen::Lower|Eigen::Upper, Eigen::IncompleteCholesky<double> > PreconditionedCG;
+
+class SparseCG : public LinearSolver<SparseMatrix, DenseMatrix>
+{
+private:
+    bool doSolve(const SparseMatrix &A, const DenseMatrix &b, DenseMatrix &x) const
+    {
+        // Init conjugate gradient solver with incomplete Cholesky preconditioning (requires symmetric positive definite matrices)
+        PreconditionedCG sparseSolver;
+        sparseSolver.setTolerance(tol);
+        sparseSolver.compute(A);
+
+        if (sparseSolver.info() == Eigen::Success)
+        {
+            // Solve LSE
+            x = sparseSolver.solve(b);
+
+            return sparseSolver.info() == Eigen::Success;
+        }
+
+        return false;
+    }
+};
+
+enum class LinearSolverType
+{
+    DENSE_QR,
+    SPARSE_LU,
+    SPARSE_QR,
+    SPARSE_LDLT,
+    SPARSE_CG
+};
+
+/*
+ * Selects a solver for A*x = b from the size, symmetry and estimated fill of A:
+ * - rectangular matrices (least squares problems) are solved with sparse QR,
+ * - small matrices are solved with dense QR, which is robust and cheap at this size,
+ * - symmetric matrices that are known to be positive definite are solved with sparse LDLT,
+ *   unless the estimated fill of the factor exceeds maxFill entries, in which case
+ *   preconditioned CG is used (its memory use is that of A),
+ * - other square matrices are solved with sparse LU.
+ * The fill is estimated by the envelope of the lower triangle, which bounds the fill of
+ * a Cholesky factor without reordering (the fill-reducing ordering of LDLT usually does better).
+ */
+inline LinearSolverType selectLinearSolver(const SparseMatrix &A, bool positiveDefinite = false,
+                                           unsigned int maxDenseSize = 128, double maxFill = pow(2,24))
+{
+    if(A.rows() != A.cols())
+    {
+        return LinearSolverType::SPARSE_QR;
+    }
+
+    if(A.rows() <= maxDenseSize)
+    {
+        return LinearSolverType::DENSE_QR;
+    }
+
+    if(positiveDefinite)
+    {
+        SparseMatrix At = A.transpose();
+        bool symmetric = ((A - At).norm() <= 1e-12*A.norm());
+
+        if(symmetric)
+        {
+            // Envelope: for each column, the distance from the diagonal to the first nonzero above it
+            double envelope = 0;
+            for(int j = 0; j < A.outerSize(); j++)
+            {
+                SparseMatrix::InnerIterator it(A, j);
+                if(it && it.row() < j)
+                {
+                    envelope += j - it.row();
+                }
+            }
+
+            if(envelope + A.rows() <= maxFill)
+            {
+                return LinearSolverType::SPARSE_LDLT;
+            }
+
+            return LinearSolverType::SPARSE_CG;
+        }
+    }
+
+    return LinearSolverType::SPARSE_LU;
+}
+
+/*
+ * Solves A*x = b with the solver chosen by selectLinearSolver.
+ */
+class SparseAutoSolver : public LinearSolver<SparseMatrix, DenseMatrix>
+{
+public:
+    SparseAutoSolver(bool positiveDefinite = false)
+        : positiveDefinite(positiveDefinite)
+    {
+    }
+
+private:
+    bool positiveDefinite;
+
+    template<class Solver>
+    static bool factorizeAndSolve(const Solver &solver, const DenseMatrix &b, DenseMatrix &x)
+    {
+        if(solver.info() != Eigen::Success)
+        {
+            return false;
+        }
+
+        x = solver.solve(b);
+
+        return solver.info() == Eigen::Success;
+    }
+
+    bool doSolve(const SparseMatrix &A, const DenseMatrix &b, DenseMatrix &x) const
+    {
+        switch(selectLinearSolver(A, positiveDefinite))
+        {
+        case LinearSolverType::DENSE_QR:
+            return factorizeAndSolve(Eigen::ColPivHouseholderQR<DenseMatrix>(A.toDense()), b, x);
+        case LinearSolverType::SPARSE_QR:
+            return factorizeAndSolve(Eigen::SparseQR<SparseMatrix, Eigen::COLAMDOrdering<int>>(A), b, x);
+        case LinearSolverType::SPARSE_LDLT:
+            return factorizeAndSolve(Eigen::SimplicialLDLT<SparseMatrix>(A), b, x);
+        case LinearSolverType::SPARSE_CG:
+        {
+            PreconditionedCG sparseSolver;
+            sparseSolver.setTolerance(tol);
+            return factorizeAndSolve(sparseSolver.compute(A), b, x);
+        }
+        default:
+            return factorizeAndSolve(Eigen::SparseLU<SparseMatrix>(A), b, x);
+        }
+    }
+};
+
+/*
+ * Mode product of the tensors in the columns of x, which are vectorized with the last index varying fastest
+ * and have dimensions sizes. All fibers along the mode are gathered as the columns of a matrix, which is
+ * replaced by op(fibers) (e.g. a matrix product or a solve with the fibers). The dimension of the mode is
+ * updated in sizes if op changes the number of rows.
+ */
+template<class Operation>
+DenseMatrix modeProduct(const DenseMatrix &x, std::vector<unsigned int> &sizes, unsigned int mode, Operation op)
+{
+    unsigned int m = sizes.at(mode);
+    unsigned int inner = 1;
+    for(unsigned int d = mode + 1; d < sizes.size(); d++)
+    {
+        inner *= sizes.at(d);
+    }
+    unsigned int outer = x.rows()/(m*inner);
+
+    DenseMatrix fibers(m, outer*inner);
+    DenseMatrix y;
+
+    for(unsigned int col = 0; col < x.cols(); col++)
+    {
+        const double *data = x.col(col).data();
+
+        for(unsigned int o = 0; o < outer; o++)
+            for(unsigned int k = 0; k < m; k++)
+                for(unsigned int i = 0; i < inner; i++)
+                    fibers(k, o*inner + i) = data[(o*m + k)*inner + i];
+
+        DenseMatrix result = op(fibers);
+        unsigned int mr = result.rows();
+
+        if(col == 0)
+        {
+            y.resize(outer*mr*inner, x.cols());
+        }
+
+        double *target = y.col(col).data();
+
+        for(unsigned int o = 0; o < outer; o++)
+            for(unsigned int k = 0; k < mr; k++)
+                for(unsigned int i = 0; i < inner; i++)
+                    target[(o*mr + k)*inner + i] = result(k, o*inner + i);
+    }
+
+    sizes.at(mode) = y.rows()/(outer*inner);
+
+    return y;
+}
+
+/*
+ * Solver for A*x = b, where A = A_0 x A_1 x ... x A_(n-1) is the Kronecker product of square sparse
+ * matrices, e.g. the collocation matrix of a tensor product B-spline on a complete grid.
+ * The columns of b and x are vectorized tensors with the last index varying fastest.
+ * Each factor is LU factorized once, and A^(-1) = A_0^(-1) x ... x A_(n-1)^(-1) is applied
+ * one mode at the time: for mode d, all fibers along d are solved for at once with the LU factors
+ * of A_d. A is never formed, and for banded factors a solve requires O(N*p) operations.
+ */
+class KroneckerSolver
+{
+public:
+    KroneckerSolver(const std::vector<SparseMatrix> &factors)
+        : factors(factors),
+          factorized(true)
+    {
+        for(auto &factor : factors)
+        {
+            std::shared_ptr< Eigen::SparseLU<SparseMatrix> > lu(new Eigen::SparseLU<SparseMatrix>);
+
+            if(factor.rows() != factor.cols())
+            {
+                throw Exception("KroneckerSolver::KroneckerSolver: Factors must be square!");
+            }
+
+            lu->analyzePattern(factor);
+            lu->factorize(factor);
+            factorized = factorized && (lu->info() == Eigen::Success);
+
+            luFactors.push_back(lu);
+            sizes.push_back(factor.rows());
+        }
+    }
+
+    bool solve(const DenseMatrix &b, DenseMatrix &x) const
+    {
+        if(b.rows() != size())
+        {
+            throw Exception("KroneckerSolver::solve: Inconsistent matrix dimensions!");
+        }
+
+        if(!factorized)
+        {
+            return false;
+        }
+
+        std::vector<unsigned int> dims = sizes;
+
+        x = b;
+        for(unsigned int mode = 0; mode < factors.size(); mode++)
+        {
+            const Eigen::SparseLU<SparseMatrix> &lu = *luFactors.at(mode);
+            x = modeProduct(x, dims, mode, [&lu](const DenseMatrix &fibers) -> DenseMatrix { return lu.solve(fibers); });
+        }
+
+        // Check the residual, with A*x computed mode by mode as well
+        return (multiply(x) - b).norm() <= tol*b.norm();
+    }
+
+    // Returns A*x
+    DenseMatrix multiply(const DenseMatrix &x) const
+    {
+        std::vector<unsigned int> dims = sizes;
+
+        DenseMatrix Ax = x;
+        for(unsigned int mode = 0; mode < factors.size(); mode++)
+        {
+            const SparseMatrix &factor = factors.at(mode);
+            Ax = modeProduct(Ax, dims, mode, [&factor](const DenseMatrix &fibers) -> DenseMatrix { return factor*fibers; });
+        }
+
+        return Ax;
+    }
+
+    bool isFactorized() const { return factorized; }
+
+    // Number of equations
+    unsigned int size() const
+    {
+        unsigned int n = 1;
+        for(auto &factor : factors)
+        {
+            n *= factor.rows();
+        }
+        return n;
+    }
+
+private:
+    double tol = 1e-12; // Relative error tolerance
+
+    std::vector<SparseMatrix> factors;
+    std::vector< std::shared_ptr< Eigen::SparseLU<SparseMatrix> > > luFactors;
+    std::vector<unsigned int> sizes;
+    bool factorized;
+};
+
+/*
+ * Solver for (G_0 x ... x G_(n-1) + lambda*(I x ... x P_d x ... x I summed over d))*x = b, where G_d and P_d
+ * are symmetric sparse matrices of equal size and G_d is positive definite. This is the system of a P-spline
+ * fitted on a complete grid with one sample per grid point, with G_d = B_d'*B_d and P_d = D_d'*D_d formed from
+ * the univariate collocation matrices B_d and difference matrices D_d (the generalized linear array model, GLAM).
+ * The matrix is never formed: its products are computed mode by mode with the small matrices, and the system
+ * is solved with the preconditioned conjugate gradient method.
+ * The preconditioner is diagonalized exactly by V = V_0 x ... x V_(n-1), where V_d holds the univariate generalized
+ * eigenvectors (P_d*v = mu*G_d*v, normalized so that V_d'*G_d*V_d = I). In this basis, the matrix equals
+ * I + lambda*sum_d (V_0'*V_0 x ... x diag(mu_d) x ... x V_(n-1)'*V_(n-1)), and the preconditioner keeps
+ * the diagonal of each V_e'*V_e. It is exact when lambda is zero or for a single variable.
+ */
+class PenalizedKroneckerSolver
+{
+public:
+    PenalizedKroneckerSolver(const std::vector<SparseMatrix> &gramFactors, const std::vector<SparseMatrix> &penaltyFactors, double lambda)
+        : gramFactors(gramFactors),
+          penaltyFactors(penaltyFactors),
+          lambda(lambda),
+          factorized(true)
+    {
+        if(gramFactors.size() != penaltyFactors.size())
+        {
+            throw Exception("PenalizedKroneckerSolver::PenalizedKroneckerSolver: Inconsistent number of factors!");
+        }
+
+        for(unsigned int d = 0; d < gramFactors.size(); d++)
+        {
+            const SparseMatrix &G = gramFactors.at(d);
+            const SparseMatrix &P = penaltyFactors.at(d);
+            if(G.rows() != G.cols() || P.rows() != G.rows() || P.cols() != G.cols())
+            {
+                throw Exception("PenalizedKroneckerSolver::PenalizedKroneckerSolver: Factors must be square and of equal size!");
+            }
+
+            Eigen::GeneralizedSelfAdjointEigenSolver<DenseMatrix> eigenSolver(P.toDense(), G.toDense());
+            factorized = factorized && (eigenSolver.info() == Eigen::Success);
+
+            eigenvectors.push_back(eigenSolver.eigenvectors());
+            eigenvalues.push_back(eigenSolver.eigenvalues());
+            weights.push_back(eigenSolver.eigenvectors().colwise().squaredNorm().transpose());
+            sizes.push_back(G.rows());
+        }
+
+        // Bounds on the infinity norms of the Gram and penalty terms
+        gramNorm = 1;
+        penaltyNorm = 0;
+        for(unsigned int d = 0; d < gramFactors.size(); d++)
+        {
+            gramNorm *= gramFactors.at(d).toDense().cwiseAbs().rowwise().sum().maxCoeff();
+            penaltyNorm += penaltyFactors.at(d).toDense().cwiseAbs().rowwise().sum().maxCoeff();
+        }
+
+        setLambda(lambda);
+    }
+
+    // Changes lambda. The eigendecompositions do not depend on lambda, so only the preconditioner diagonal is recomputed.
+    void setLambda(double lambda)
+    {
+        this->lambda = lambda;
+        matrixNorm = gramNorm + lambda*penaltyNorm;
+
+        // Inverse diagonal of the preconditioner in the eigenvector basis, 1/(1 + lambda*sum_d mu_d(k_d)*prod_(e != d) w_e(k_e)),
+        // where the tensor index (k_0, ..., k_(n-1)) is incremented with the last index varying fastest
+        unsigned int n = sizes.size();
+        std::vector<unsigned int> index(n, 0);
+        inverseDiagonal.resize(size());
+
+        for(unsigned int i = 0; i < inverseDiagonal.size(); i++)
+        {
+            double sum = 0;
+            for(unsigned int d = 0; d < n; d++)
+            {
+                double term = lambda*eigenvalues.at(d)(index.at(d));
+                for(unsigned int e = 0; e < n; e++)
+                {
+                    if(e != d)
+                    {
+                        term *= weights.at(e)(index.at(e));
+                    }
+                }
+                sum += term;
+            }
+
+            inverseDiagonal(i) = 1/(1 + sum);
+
+            for(int d = n - 1; d >= 0 && ++index.at(d) == sizes.at(d); d--)
+            {
+                index.at(d) = 0;
+            }
+        }
+    }
+
+    // Solves for each column of b. Returns false unless the normwise backward error, |A*x - b|/(|A|*|x| + |b|),
+    // reaches the tolerance (a relative residual of 1e-12 cannot be reached when A is ill-conditioned, e.g. for large lambda)
+    bool solve(const DenseMatrix &b, DenseMatrix &x) const
+    {
+        if(b.rows() != size())
+        {
+            throw Exception("PenalizedKroneckerSolver::solve: Inconsistent matrix dimensions!");
+        }
+
+        if(!factorized)
+        {
+            return false;
+        }
+
+        x.setZero(b.rows(), b.cols());
+
+        for(unsigned int col = 0; col < b.cols(); col++)
+        {
+            double bnorm = b.col(col).norm();
+            if(bnorm == 0)
+            {
+                continue;
+            }
+
+            DenseMatrix r = b.col(col);
+            DenseMatrix z, p, Ap, xk = DenseMatrix::Zero(b.rows(), 1);
+            z = precondition(r);
+            p = z;
+            double rz = r.col(0).dot(z.col(0));
+
+            bool converged = false;
+            for(unsigned int k = 0; k < maxIterations; k++)
+            {
+                Ap = multiply(p);
+                double alpha = rz/p.col(0).dot(Ap.col(0));
+                xk += alpha*p;
+                r -= alpha*Ap;
+
+                if(r.norm() <= tol*(matrixNorm*xk.norm() + bnorm))
+                {
+                    converged = true;
+                    break;
+                }
+
+                z = precondition(r);
+                double rzNext = r.col(0).dot(z.col(0));
+                p = z + (rzNext/rz)*p;
+                rz = rzNext;
+            }
+
+            // Check the true residual, which may drift from the updated one
+            if(!converged || (multiply(xk) - b.col(col)).norm() > 10*tol*(matrixNorm*xk.norm() + bnorm))
+            {
+                return false;
+            }
+
+            x.col(col) = xk;
+        }
+
+        return true;
+    }
+
+    // Returns A*x
+    DenseMatrix multiply(const DenseMatrix &x) const
+    {
+        std::vector<unsigned int> dims = sizes;
+
+        DenseMatrix Ax = x;
+        for(unsigned int mode = 0; mode < gramFactors.size(); mode++)
+        {
+            const SparseMatrix &G = gramFactors.at(mode);
+            Ax = modeProduct(Ax, dims, mode, [&G](const DenseMatrix &fibers) -> DenseMatrix { return G*fibers; });
+        }
+
+        for(unsigned int mode = 0; mode < penaltyFactors.size(); mode++)
+        {
+            const SparseMatrix &P = penaltyFactors.at(mode);
+            Ax += lambda*modeProduct(x, dims, mode, [&P](const DenseMatrix &fibers) -> DenseMatrix { return P*fibers; });
+        }
+
+        return Ax;
+    }
+
+    bool isFactorized() const { return factorized; }
+
+    // Number of equations
+    unsigned int size() const
+    {
+        unsigned int n = 1;
+        for(auto size : sizes)
+        {
+            n *= size;
+        }
+        return n;
+    }
+
+private:
+    double tol = 1e-12; // Relative error tolerance
+    unsigned int maxIterations = 1000;
+
+    std::vector<SparseMatrix> gramFactors;
+    std::vector<SparseMatrix> penaltyFactors;
+    double lambda;
+    double gramNorm, penaltyNorm;
+    double matrixNorm;
+    std::vector<unsigned int> sizes;
+    bool factorized;
+
+    // Preconditioner M^(-1) = V*inverseDiagonal*V', with V = V_0 x ... x V_(n-1).
+    // The eigenvalues mu_d and the weights w_d (squared column norms of V_d) give its diagonal for any lambda.
+    std::vector<DenseMatrix> eigenvectors;
+    std::vector<DenseVector> eigenvalues;
+    std::vector<DenseVector> weights;
+    DenseVector inverseDiagonal;
+
+    DenseMatrix precondition(const DenseMatrix &r) const
+    {
+        std::vector<unsigned int> dims = sizes;
+
+        DenseMatrix z = r;
+        for(unsigned int mode = 0; mode < eigenvectors.size(); mode++)
+        {
+            const DenseMatrix &V = eigenvectors.at(mode);
+            z = modeProduct(z, dims, mode, [&V](const DenseMatrix &fibers) -> DenseMatrix { return V.transpose()*fibers; });
+        }
+
+        z.col(0) = z.col(0).cwiseProduct(inverseDiagonal);
+
+        for(unsigned int mode = 0; mode < eigenvectors.size(); mode++)
+        {
+            const DenseMatrix &V = eigenvectors.at(mode);
+            z = modeProduct(z, dims, mode, [&V](const DenseMatrix &fibers) -> DenseMatrix { return V*fibers; });
+        }
+
+        return z;
+    }
+};
+
 } // namespace MultivariateSplines
 
 #endif // MS_LINEARSOLVER_H
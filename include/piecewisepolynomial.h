@@ -0,0 +1,76 @@
+/*
+ * This file is part of the Multivariate Splines library.
+ * Copyright (C) 2012 Bjarne Grimstad (bjarne.grimstad@gmail.com)
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+
+#ifndef MS_PIECEWISEPOLYNOMIAL_H
+#define MS_PIECEWISEPOLYNOMIAL_H
+
+#include "generaldefinitions.h"
+#include "spline.h"
+#include "bspline.h"
+
+namespace MultivariateSplines
+{
+
+/*
+ * Piecewise polynomial representation of a tensor product B-spline.
+ * The domain is divided into cells by the distinct knots, and on each cell the spline
+ * is stored as a tensor product polynomial in power form, in the local variables
+ * t_d = x_d - (lower bound of the cell in dimension d).
+ * Evaluation consists of a cell lookup followed by nested Horner evaluation,
+ * which is faster than B-spline evaluation at the cost of storing prod_d (p_d+1)
+ * coefficients per cell. The representation is not updated if the B-spline is changed.
+ */
+class PiecewisePolynomial : public Spline
+{
+public:
+    PiecewisePolynomial(const BSpline &bspline);
+
+    virtual PiecewisePolynomial* clone() const { return new PiecewisePolynomial(*this); }
+
+    // Evaluation
+    double eval(DenseVector x) const;
+    DenseMatrix evalJacobian(DenseVector x) const;
+    DenseMatrix evalHessian(DenseVector x) const;
+
+    // Getters
+    unsigned int getNumVariables() const { return numVariables; }
+    unsigned int getNumCells() const { return numCells; }
+    std::vector<unsigned int> getDegrees() const { return degrees; }
+    std::vector< std::vector<double> > getBreakpoints() const { return breakpoints; }
+
+    std::vector<double> getDomainUpperBound() const;
+    std::vector<double> getDomainLowerBound() const;
+
+private:
+    unsigned int numVariables;
+    unsigned int numCells;
+    unsigned int blockSize; // Number of coefficients per cell, prod_d (p_d+1)
+
+    std::vector<unsigned int> degrees;
+    std::vector< std::vector<double> > breakpoints; // Distinct knots in each dimension
+    std::vector<unsigned int> cellStride; // Cells are ordered with the last variable varying fastest
+
+    // Polynomial coefficients, one block per cell. In a block, the coefficient of
+    // t_0^k_0*...*t_(n-1)^k_(n-1) is stored at sum_d k_d*prod_(e>d) (p_e+1)
+    std::vector<double> coefficients;
+
+    // Conversion from the B-spline
+    void convertBlock(double *block, unsigned int dim, double cellWidth) const;
+
+    // Finds the cell containing x, computes the local variables t, and returns the first coefficient of the cell
+    const double* locateCell(const DenseVector &x, double *t) const;
+
+    // Nested Horner evaluation of the derivative of the given orders (one per variable) of a cell polynomial
+    double evalCell(const double *block, const double *t, const unsigned int *orders, double *work) const;
+};
+
+} // namespace MultivariateSplines
+
+#endif // MS_PIECEWISEPOLYNOMIAL_H
@@ -16,6 +16,13 @@
 namespace MultivariateSplines
 {
 
+// Criteria for automatic selection of the smoothing parameter
+enum class SmoothingCriterion
+{
+    GCV,    // Generalized cross-validation
+    REML    // Restricted maximum likelihood
+};
+
 /*
  * The P-Spline is a smooting spline which relaxes the interpolation constraints on the control points to allow smoother spline curves.
  * It minimizes objective which penalizes both deviation (for interpolation) and second derivative (for smoothing).
@@ -27,6 +34,12 @@ public:
 
     PSpline(const DataTable &samples);
     PSpline(const DataTable &samples, double lambda);
+    PSpline(const DataTable &samples, SmoothingCriterion criterion); // Selects lambda (see BSplineFitter::selectLambda)
+
+    double getLambda() const { return lambda; }
+
+    // Second-order finite difference matrix for the coefficients of the given basis
+    static void getSecondOrderFiniteDifferenceMatrix(const BSplineBasis &basis, SparseMatrix &D);
 
 protected:
 
@@ -35,7 +48,6 @@ protected:
 
     // P-spline control point calculation
     void computeControlPoints(const DataTable &samples) override;
-    void getSecondOrderFiniteDifferenceMatrix(SparseMatrix &D);
 
 };
 
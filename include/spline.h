@@ -39,6 +39,21 @@ public:
      * Returns the (numVariables x numVariables) Hessian evaluated at x
      */
     virtual DenseMatrix evalHessian(DenseVector x) const = 0;
+
+    /*
+     * Batch evaluation at the n points given by the rows of the (n x numVariables) matrix X.
+     * The points are evaluated in parallel by the default thread pool (see ThreadPool).
+     * The output buffers are only resized if they do not already have the required size.
+     */
+
+    // Fills the (n x 1) vector y with the spline values
+    virtual void evalBatch(const DenseMatrix &X, DenseVector &y) const;
+
+    // Fills the (n x numVariables) matrix J, where row i is the Jacobian at point i
+    virtual void evalJacobianBatch(const DenseMatrix &X, DenseMatrix &J) const;
+
+    // Fills the (n x numVariables^2) matrix H, where row i is the Hessian at point i (stored column by column)
+    virtual void evalHessianBatch(const DenseMatrix &X, DenseMatrix &H) const;
 };
 
 } // namespace MultivariateSplines
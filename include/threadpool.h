@@ -0,0 +1,93 @@
+/*
+ * This file is part of the Multivariate Splines library.
+ * Copyright (C) 2012 Bjarne Grimstad (bjarne.grimstad@gmail.com)
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+
+#ifndef MS_THREADPOOL_H
+#define MS_THREADPOOL_H
+
+#include "generaldefinitions.h"
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+namespace MultivariateSplines
+{
+
+/*
+ * Thread pool for data parallel loops.
+ * The worker threads are started once and reused by all calls to parallelFor.
+ * The iteration range is split into chunks which are distributed evenly among the threads.
+ * A thread that runs out of chunks steals half of the remaining chunks of another thread.
+ */
+class ThreadPool
+{
+public:
+    ThreadPool(); // One thread per hardware thread
+    ThreadPool(unsigned int numThreads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    /*
+     * Calls body(begin, end) for consecutive chunks [begin, end) covering [0, n),
+     * and returns when all chunks are done. The calling thread takes part in the work.
+     * Chunks of chunkSize iterations are used (chunkSize = 0 chooses a size automatically).
+     * The first exception thrown by body is rethrown in the calling thread.
+     * Calls from within body are run serially by the calling worker.
+     */
+    void parallelFor(unsigned int n, unsigned int chunkSize, const std::function<void(unsigned int, unsigned int)> &body);
+
+    unsigned int getNumThreads() const { return numThreads; }
+
+    // Pool used by the batch evaluation functions of the splines
+    static ThreadPool &getDefault();
+    static void setDefaultNumThreads(unsigned int numThreads); // Must not be called while the default pool is in use
+
+private:
+    // Range of chunk indices [begin, end) owned by one thread
+    struct ChunkQueue
+    {
+        std::mutex mutex;
+        unsigned int begin;
+        unsigned int end;
+    };
+
+    unsigned int numThreads;
+    std::vector<std::thread> workers; // numThreads-1 workers, the calling thread is thread 0
+    std::vector< std::unique_ptr<ChunkQueue> > queues;
+
+    // Current job
+    const std::function<void(unsigned int, unsigned int)> *body;
+    unsigned int numIterations;
+    unsigned int chunkSize;
+    std::exception_ptr error;
+
+    // Synchronization
+    std::mutex jobMutex; // Serializes calls to parallelFor
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    std::condition_variable finished;
+    unsigned long generation;
+    unsigned int numBusy;
+    bool stop;
+
+    void init(unsigned int numThreads);
+    void workerLoop(unsigned int id);
+    void runChunks(unsigned int id);
+    bool popChunk(unsigned int id, unsigned int &chunk);
+    bool stealChunks(unsigned int id);
+};
+
+} // namespace MultivariateSplines
+
+#endif // MS_THREADPOOL_H
@@ -12,9 +12,14 @@
 #include "include/bsplinebasis.h"
 #include "include/mykroneckerproduct.h"
 #include "unsupported/Eigen/KroneckerProduct"
+#include "include/bsplinefitter.h"
 #include "include/linearsolvers.h"
+#include "include/threadpool.h"
+#include <Eigen/SparseCholesky>
 
 #include <iostream>
+#include <limits>
+#include <algorithm>
 
 namespace MultivariateSplines
 {
@@ -24,7 +29,7 @@ BSpline::BSpline(DenseMatrix coefficients, std::vector< std::vector<double> > kn
     : coefficients(coefficients)
 {
     numVariables = knotVectors.size();
-    assert(coefficients.rows() == 1);
+    assert(coefficients.rows() >= 1);
 
     basis = BSplineBasis(knotVectors, basisDegrees, KnotVectorType::EXPLICIT);
 
@@ -91,20 +96,113 @@ void BSpline::init()
 
 double BSpline::eval(DenseVector x) const
 {
+    if(coefficients.rows() != 1)
+    {
+        throw Exception("BSpline::eval: B-spline has several outputs (use evalVector and evalJacobian).");
+    }
+
+    if(!pointInDomain(x))
+    {
+        throw Exception("BSpline::eval: Evaluation at point outside domain.");
+    }
+
+    // Evaluate the supported basis functions in each dimension and contract them with the coefficients
+    StackBuffer<int> first(numVariables);
+    StackBuffer<double> values(basis.numSupportedValues());
+
+    basis.evalSupported(x, first.data(), values.data());
+
+    return basis.contractSupported(first.data(), values.data(), coefficients.data());
+}
+
+/*
+ * Evaluation for sequences of nearby points (e.g. from time-stepping or line searches).
+ * hint stores the indices of the supported basis functions at the previous point, which are
+ * used as starting points for the knot interval searches, and is updated with those at x.
+ * Pass an empty vector in the first call.
+ */
+double BSpline::eval(const DenseVector &x, std::vector<int> &hint) const
+{
+    if(coefficients.rows() != 1)
+    {
+        throw Exception("BSpline::eval: B-spline has several outputs (use evalVector and evalJacobian).");
+    }
+
     if(!pointInDomain(x))
     {
         throw Exception("BSpline::eval: Evaluation at point outside domain.");
     }
 
-    SparseVector tensorvalues = basis.eval(x);
-    DenseVector y = coefficients*tensorvalues;
-    return y(0);
+    bool useHints = (hint.size() == numVariables);
+    hint.resize(numVariables);
+
+    StackBuffer<double> values(basis.numSupportedValues());
+
+    basis.evalSupported(x, hint.data(), values.data(), useHints);
+
+    return basis.contractSupported(hint.data(), values.data(), coefficients.data());
+}
+
+/*
+ * Returns the values of all outputs at x.
+ * The supported basis functions are evaluated once and contracted with the coefficients of all outputs.
+ */
+DenseVector BSpline::evalVector(DenseVector x) const
+{
+    if(!pointInDomain(x))
+    {
+        throw Exception("BSpline::evalVector: Evaluation at point outside domain.");
+    }
+
+    StackBuffer<int> first(numVariables);
+    StackBuffer<double> values(basis.numSupportedValues());
+
+    basis.evalSupported(x, first.data(), values.data());
+
+    DenseVector y(coefficients.rows());
+    basis.contractSupported(first.data(), values.data(), coefficients.data(), coefficients.rows(), y.data());
+
+    return y;
+}
+
+void BSpline::evalBatch(const DenseMatrix &X, DenseVector &y) const
+{
+    if(X.cols() != numVariables)
+    {
+        throw Exception("BSpline::evalBatch: Points have wrong dimension.");
+    }
+
+    if(coefficients.rows() != 1)
+    {
+        throw Exception("BSpline::evalBatch: B-spline has several outputs (use evalVector and evalJacobian).");
+    }
+
+    y.resize(X.rows());
+
+    std::vector<double> lb = getDomainLowerBound();
+    std::vector<double> ub = getDomainUpperBound();
+
+    ThreadPool::getDefault().parallelFor(X.rows(), 0, [&](unsigned int begin, unsigned int end)
+    {
+        for(unsigned int dim = 0; dim < numVariables; dim++)
+        {
+            for(unsigned int i = begin; i < end; i++)
+            {
+                if(!(lb.at(dim) <= X(i,dim) && X(i,dim) <= ub.at(dim)))
+                {
+                    throw Exception("BSpline::evalBatch: Evaluation at point outside domain.");
+                }
+            }
+        }
+
+        basis.contractBatch(X, begin, end, coefficients.data(), y.data());
+    });
 }
 
 /*
  * Returns the Jacobian evaluated at x.
- * The Jacobian is an 1 x n matrix,
- * where n is the dimension of x.
+ * The Jacobian is an m x n matrix,
+ * where m is the number of outputs and n is the dimension of x.
  */
 DenseMatrix BSpline::evalJacobian(DenseVector x) const
 {
@@ -113,21 +211,49 @@ DenseMatrix BSpline::evalJacobian(DenseVector x) const
         throw Exception("BSpline::evalJacobian: Evaluation at point outside domain.");
     }
 
-    DenseMatrix Bi = basis.evalBasisJacobianOld(x); // Old Jacobian implementation
-    //SparseMatrix Ji = basis.evalBasisJacobian(x);   // New Jacobian implementation
+    // Evaluate the supported basis functions and their first derivatives in each dimension,
+    // and compute all partial derivatives in one pass over the supported coefficients
+    StackBuffer<int> first(numVariables);
+    StackBuffer<double> table(2*basis.numSupportedValues());
 
-//    // Test difference in Jacobians
-//    DenseMatrix Jid(Ji);
-//    DenseMatrix dJ = Bi - Jid;
-//    DenseVector errorVec = dJ.rowwise().maxCoeff();
-//    DenseVector error = errorVec.colwise().maxCoeff();
-//    if (std::abs(error(0)) > 1e-10)
-//    {
-//        std::cout << "NOTABLE DIFFERENCE IN JACOBIANS: " << std::abs(error(0)) << std::endl;
-//        exit(1);
-//    }
+    basis.evalSupportedDerivatives(x, 1, first.data(), table.data());
 
-    return coefficients*Bi;
+    DenseMatrix J(coefficients.rows(), numVariables);
+
+    if(coefficients.rows() == 1)
+    {
+        double value;
+        basis.contractSupportedDerivatives(first.data(), table.data(), 1, coefficients.data(), value, J.data(), nullptr);
+    }
+    else
+    {
+        StackBuffer<double> values(coefficients.rows());
+        basis.contractSupportedJacobian(first.data(), table.data(), coefficients.data(), coefficients.rows(), values.data(), J.data());
+    }
+
+    return J;
+}
+
+void BSpline::evalJacobianBatch(const DenseMatrix &X, DenseMatrix &J) const
+{
+    if(coefficients.rows() == 1)
+    {
+        Spline::evalJacobianBatch(X, J);
+        return;
+    }
+
+    J.resize(X.rows(), coefficients.rows()*X.cols());
+
+    ThreadPool::getDefault().parallelFor(X.rows(), 0, [&](unsigned int begin, unsigned int end)
+    {
+        DenseVector x(X.cols());
+        for(unsigned int i = begin; i < end; i++)
+        {
+            x = X.row(i).transpose();
+            DenseMatrix Ji = evalJacobian(x);
+            J.row(i) = Eigen::Map<const DenseVector>(Ji.data(), Ji.size()).transpose();
+        }
+    });
 }
 
 /*
@@ -137,26 +263,88 @@ DenseMatrix BSpline::evalJacobian(DenseVector x) const
  */
 DenseMatrix BSpline::evalHessian(DenseVector x) const
 {
+    if(coefficients.rows() != 1)
+    {
+        throw Exception("BSpline::evalHessian: B-spline has several outputs (use evalVector and evalJacobian).");
+    }
+
     if(!pointInDomain(x))
     {        
         throw Exception("BSpline::evalHessian: Evaluation at point outside domain.");
     }
 
-    DenseMatrix H;
-    H.setZero(1,1);
-    DenseMatrix identity = DenseMatrix::Identity(numVariables,numVariables);
-    DenseMatrix caug;
-    caug = kroneckerProduct(identity, coefficients);
-    DenseMatrix DB = basis.evalBasisHessian(x);
-    H = caug*DB;
+    // Evaluate the supported basis functions and their first and second derivatives in each dimension,
+    // and compute the Hessian in one pass over the supported coefficients
+    StackBuffer<int> first(numVariables);
+    StackBuffer<double> table(3*basis.numSupportedValues());
+
+    basis.evalSupportedDerivatives(x, 2, first.data(), table.data());
+
+    double value;
+    StackBuffer<double> gradient(numVariables);
+    DenseMatrix H(numVariables, numVariables);
+    basis.contractSupportedDerivatives(first.data(), table.data(), 2, coefficients.data(), value, gradient.data(), H.data());
+
     return H;
 }
 
+/*
+ * Evaluates the value and, up to the given order, the Jacobian and the Hessian at x.
+ * The domain check and the evaluation of the basis functions and their derivatives
+ * are done once, and all results are computed in one pass over the supported coefficients.
+ * Matrices of derivatives that are not requested are left unchanged.
+ */
+void BSpline::evalAll(const DenseVector &x, double &value, DenseMatrix &jacobian, DenseMatrix &hessian, unsigned int order) const
+{
+    if(order > 2)
+    {
+        throw Exception("BSpline::evalAll: Derivatives of order higher than two are not supported.");
+    }
+
+    if(coefficients.rows() != 1)
+    {
+        throw Exception("BSpline::evalAll: B-spline has several outputs (use evalVector and evalJacobian).");
+    }
+
+    if(!pointInDomain(x))
+    {
+        throw Exception("BSpline::evalAll: Evaluation at point outside domain.");
+    }
+
+    StackBuffer<int> first(numVariables);
+    StackBuffer<double> table((order + 1)*basis.numSupportedValues());
+
+    basis.evalSupportedDerivatives(x, order, first.data(), table.data());
+
+    if(order >= 1)
+    {
+        jacobian.resize(1, numVariables);
+    }
+    if(order >= 2)
+    {
+        hessian.resize(numVariables, numVariables);
+    }
+
+    basis.contractSupportedDerivatives(first.data(), table.data(), order, coefficients.data(), value,
+                                       order >= 1 ? jacobian.data() : nullptr,
+                                       order >= 2 ? hessian.data() : nullptr);
+}
+
 std::vector< std::vector<double> > BSpline::getKnotVectors() const
 {
     return basis.getKnotVectors();
 }
 
+std::vector<unsigned int> BSpline::getBasisDegrees() const
+{
+    std::vector<unsigned int> degrees;
+    for(unsigned int dim = 0; dim < numVariables; dim++)
+    {
+        degrees.push_back(basis.getBasisDegree(dim));
+    }
+    return degrees;
+}
+
 std::vector<double> BSpline::getDomainUpperBound() const
 {
     return basis.getSupportUpperBound();
@@ -167,24 +355,27 @@ std::vector<double> BSpline::getDomainLowerBound() const
     return basis.getSupportLowerBound();
 }
 
+// Returns the control points as columns: the knot averages followed by the coefficients of each output
 DenseMatrix BSpline::getControlPoints() const
 {
     int nc = coefficients.cols();
-    DenseMatrix controlPoints(numVariables + 1, nc);
+    int numOutputs = coefficients.rows();
+    DenseMatrix controlPoints(numVariables + numOutputs, nc);
 
     controlPoints.block(0, 0, numVariables, nc) = knotaverages;
-    controlPoints.block(numVariables, 0, 1, nc) = coefficients;
+    controlPoints.block(numVariables, 0, numOutputs, nc) = coefficients;
 
     return controlPoints;
 }
 
 void BSpline::setControlPoints(DenseMatrix &controlPoints)
 {
-    assert(controlPoints.rows() == numVariables + 1);
+    assert(controlPoints.rows() > numVariables);
     int nc = controlPoints.cols();
+    int numOutputs = controlPoints.rows() - numVariables;
 
     knotaverages = controlPoints.block(0, 0, numVariables, nc);
-    coefficients = controlPoints.block(numVariables, 0, 1, nc);
+    coefficients = controlPoints.block(numVariables, 0, numOutputs, nc);
 
     checkControlPoints();
 }
@@ -193,11 +384,11 @@ bool BSpline::checkControlPoints() const
 {
     assert(coefficients.cols() == knotaverages.cols());
     assert(knotaverages.rows() == numVariables);
-    assert(coefficients.rows() == 1);
+    assert(coefficients.rows() >= 1);
     return true;
 }
 
-bool BSpline::pointInDomain(DenseVector x) const
+bool BSpline::pointInDomain(const DenseVector &x) const
 {
     return basis.insideSupport(x);
 }
@@ -312,175 +503,334 @@ void BSpline::computeKnotAverages()
     assert(knotaverages.rows() == numVariables && knotaverages.cols() == basis.numBasisFunctions());
 }
 
+/*
+ * Computes the control coefficients that interpolate the samples (see BSplineFitter),
+ * and the knot averages from the knot vectors.
+ */
 void BSpline::computeControlPoints(const DataTable &samples)
 {
-    /* Setup and solve equations Ac = b,
-     * A = basis functions at sample x-values,
-     * b = sample y-values when calculating control coefficients,
-     * b = sample x-values when calculating knot averages
-     * c = control coefficients or knot averages.
-     */
-    SparseMatrix A;
-    computeBasisFunctionMatrix(samples, A);
+    BSplineFitter fitter(samples, basis);
 
-    DenseMatrix Bx, By;
-    controlPointEquationRHS(samples, Bx, By);
+    std::vector<double> y = samples.getVectorY();
+    coefficients = fitter.solve(Eigen::Map<DenseVector>(y.data(), y.size())).transpose();
 
-    DenseMatrix Cx, Cy;
+    computeKnotAverages();
+}
+
+bool BSpline::insertKnots(double tau, unsigned int dim, unsigned int multiplicity)
+{
+    return insertKnots(std::vector<double>(multiplicity, tau), dim);
+}
+
+bool BSpline::insertKnots(const std::vector<double> &tau, unsigned int dim)
+{
+    if(dim >= numVariables)
+        return false;
 
-    int numEquations = A.rows();
-    int maxNumEquations = pow(2,10);
+    std::vector< std::vector<double> > knots(numVariables);
+    knots.at(dim) = tau;
 
-    bool solveAsDense = (numEquations < maxNumEquations);
+    return insertKnots(knots);
+}
 
-    if(!solveAsDense)
+/*
+ * Inserts the knots tau.at(dim) in each dimension dim. The multivariate knot insertion matrix is the
+ * Kronecker product of the univariate ones, so the control points are updated by one mode product per
+ * dimension with knots to insert, and the multivariate matrix is never formed.
+ * Returns false, and leaves the B-spline unchanged, if any of the knots cannot be inserted.
+ */
+bool BSpline::insertKnots(const std::vector< std::vector<double> > &tau)
+{
+    if(tau.size() != numVariables)
+        return false;
+
+    BSplineBasis refinedBasis = basis;
+    std::vector<SparseMatrix> A(numVariables);
+
+    for(unsigned int dim = 0; dim < numVariables; dim++)
     {
-#ifndef NDEBUG
-        std::cout << "Computing B-spline control points using sparse solver." << std::endl;
-#endif // NDEBUG
+        if(!tau.at(dim).empty() && !refinedBasis.insertKnots(A.at(dim), tau.at(dim), dim))
+            return false;
+    }
 
-        SparseLU s;
-        bool successfulSolve = (s.solve(A,Bx,Cx) && s.solve(A,By,Cy));
+    std::vector<unsigned int> sizes = numBasisFunctionsPerDimension();
+    basis = refinedBasis;
 
-        solveAsDense = !successfulSolve;
+    for(unsigned int dim = 0; dim < numVariables; dim++)
+    {
+        if(!tau.at(dim).empty())
+            transformControlPoints(A.at(dim), dim, sizes);
     }
 
-    if(solveAsDense)
+    return true;
+}
+
+bool BSpline::refineKnotVectors()
+{
+    // Compute knot insertion matrices
+    std::vector<unsigned int> sizes = numBasisFunctionsPerDimension();
+    std::vector<SparseMatrix> A;
+    if(!basis.refineKnots(A))
+        return false;
+
+    // Update control points
+    for(unsigned int dim = 0; dim < numVariables; dim++)
+        transformControlPoints(A.at(dim), dim, sizes);
+
+    return true;
+}
+
+BSpline BSpline::removeKnots(double tolerance) const
+{
+    double compressionRatio;
+    return removeKnots(tolerance, compressionRatio);
+}
+
+/*
+ * The coefficients on the coarser knots are the least squares approximation of the coefficients on the current
+ * knots, through the knot insertion matrix. By the convex hull property, the B-spline then changes by at most the
+ * largest change of a coefficient when the approximation is expressed on the current knots again. The changes in
+ * the dimensions add up, so the tolerance is shared among the dimensions that remain, and the part that one
+ * dimension does not use is passed on to the next.
+ */
+BSpline BSpline::removeKnots(double tolerance, double &compressionRatio) const
+{
+    if(tolerance < 0)
     {
-#ifndef NDEBUG
-        std::cout << "Computing B-spline control points using dense solver." << std::endl;
-#endif // NDEBUG
+        throw Exception("BSpline::removeKnots: Tolerance must be nonnegative.");
+    }
 
-        DenseMatrix Ad = A.toDense();
-        DenseQR s;
-        bool successfulSolve = (s.solve(Ad,Bx,Cx) && s.solve(Ad,By,Cy));
-        if(!successfulSolve)
-        {
-            throw Exception("BSpline::computeControlPoints: Failed to solve for B-spline coefficients.");
-        }
+    std::vector<unsigned int> sizes = numBasisFunctionsPerDimension();
+    std::vector< std::vector<double> > knotVectors = basis.getKnotVectors();
+    DenseMatrix X = coefficients.transpose();
+
+    double remaining = tolerance;
+    for(unsigned int dim = 0; dim < numVariables; dim++)
+    {
+        double error = removeKnots(X, sizes, knotVectors.at(dim), basis.getBasisDegree(dim), dim, remaining/(numVariables - dim));
+        remaining = std::max(remaining - error, 0.0);
     }
 
-    coefficients = Cy.transpose();
-    knotaverages = Cx.transpose();
+    BSpline compressed(X.transpose(), knotVectors, getBasisDegrees());
+
+    compressionRatio = (double)coefficients.cols()/X.rows();
+
+    return compressed;
 }
 
-void BSpline::computeBasisFunctionMatrix(const DataTable &samples, SparseMatrix &A) const
+/*
+ * Knots are removed in rounds. In each round, the interior knots are ranked by their weights, and a set of
+ * candidates without neighbouring knots is chosen in order of increasing weight. The largest number of
+ * candidates that can be removed within the tolerance is found by bisection. The approximation is always
+ * computed from the original coefficients, so the errors of the rounds do not add up.
+ */
+double BSpline::removeKnots(DenseMatrix &X, std::vector<unsigned int> &sizes, std::vector<double> &knots, unsigned int degree, unsigned int dim, double tolerance)
 {
-    unsigned int numVariables = samples.getNumVariables();
-    unsigned int numSamples = samples.getNumSamples();
+    const DenseMatrix originalX = X;
+    const std::vector<double> originalKnots = knots;
 
-    int nnzPrCol = basis.supportedPrInterval();
+    std::vector<unsigned int> removed; // Indices of the removed knots in originalKnots
+    std::vector<unsigned int> kept;    // Indices of the knots that are left
+    for(unsigned int i = 0; i < originalKnots.size(); i++)
+        kept.push_back(i);
 
-    A.resize(numSamples, basis.numBasisFunctions());
-    A.reserve(DenseVector::Constant(numSamples, nnzPrCol)); // TODO: should reserve nnz per row!
+    std::vector<unsigned int> coarseSizes = sizes;
+    double error = 0;
 
-    int i = 0;
-    for(auto it = samples.cbegin(); it != samples.cend(); ++it, ++i)
+    while(true)
     {
-        DenseVector xi(numVariables);
-        std::vector<double> xv = it->getX();
-        for(unsigned int j = 0; j < numVariables; ++j)
+        unsigned int n = coarseSizes.at(dim);
+        std::vector<double> weights = knotWeights(X, coarseSizes, knots, degree, dim);
+
+        std::vector<unsigned int> order;
+        for(unsigned int i = degree + 1; i < n; i++)
+            order.push_back(i);
+        std::stable_sort(order.begin(), order.end(), [&weights, degree](unsigned int a, unsigned int b)
+        {
+            return weights.at(a - degree - 1) < weights.at(b - degree - 1);
+        });
+
+        std::vector<bool> blocked(knots.size(), false);
+        std::vector<unsigned int> candidates;
+        for(auto i : order)
         {
-            xi(j) = xv.at(j);
+            if(blocked.at(i))
+                continue;
+            candidates.push_back(kept.at(i));
+            blocked.at(i-1) = true;
+            blocked.at(i+1) = true;
         }
 
-        SparseVector basisValues = basis.eval(xi);
+        auto removeCandidates = [&](unsigned int numRemoved)
+        {
+            std::vector<unsigned int> indices = removed;
+            indices.insert(indices.end(), candidates.begin(), candidates.begin() + numRemoved);
+            std::sort(indices.begin(), indices.end());
+            return indices;
+        };
+
+        // Largest number of candidates that can be removed
+        DenseMatrix Y;
+        std::vector<double> coarseKnots;
+        unsigned int lower = 0, upper = candidates.size();
+        while(lower < upper)
+        {
+            unsigned int mid = (lower + upper + 1)/2;
+            if(approximateWithoutKnots(originalX, sizes, originalKnots, degree, dim, removeCandidates(mid), Y, coarseKnots) <= tolerance)
+                lower = mid;
+            else
+                upper = mid - 1;
+        }
+
+        if(lower == 0)
+            break;
 
-        for (SparseVector::InnerIterator it2(basisValues); it2; ++it2)
+        removed = removeCandidates(lower);
+        error = approximateWithoutKnots(originalX, sizes, originalKnots, degree, dim, removed, X, knots);
+        coarseSizes.at(dim) = sizes.at(dim) - removed.size();
+
+        kept.clear();
+        for(unsigned int i = 0, j = 0; i < originalKnots.size(); i++)
         {
-            A.insert(i,it2.index()) = it2.value();
+            if(j < removed.size() && removed.at(j) == i)
+                j++;
+            else
+                kept.push_back(i);
         }
     }
 
-    A.makeCompressed();
+    sizes = coarseSizes;
+
+    return error;
 }
 
-void BSpline::controlPointEquationRHS(const DataTable &samples, DenseMatrix &Bx, DenseMatrix &By) const
+/*
+ * The derivative of order p of a spline of degree p is constant on each knot interval. A knot where it barely
+ * jumps can be removed with a small error: the weight of knot i is the largest jump over all fibers (and
+ * outputs), times (t(i+1) - t(i-1))^p. The derivative coefficients are computed without the constant factors.
+ */
+std::vector<double> BSpline::knotWeights(const DenseMatrix &X, const std::vector<unsigned int> &sizes, const std::vector<double> &knots, unsigned int degree, unsigned int dim)
 {
-    unsigned int numVariables = samples.getNumVariables();
-    unsigned int numSamples = samples.getNumSamples();
-
-    Bx.resize(numSamples, numVariables);
-    By.resize(numSamples, 1);
+    unsigned int n = sizes.at(dim);
+    std::vector<double> jumps(n, 0.0);
+    std::vector<double> c(n);
 
-    int i = 0;
-    for(auto it = samples.cbegin(); it != samples.cend(); ++it, ++i)
+    std::vector<unsigned int> dims = sizes;
+    modeProduct(X, dims, dim, [&](const DenseMatrix &fibers) -> DenseMatrix
     {
-        std::vector<double> x = it->getX();
-
-        for(unsigned int j = 0; j < x.size(); ++j)
+        for(unsigned int col = 0; col < fibers.cols(); col++)
         {
-            Bx(i,j) = x.at(j);
+            for(unsigned int j = 0; j < n; j++)
+                c.at(j) = fibers(j, col);
+
+            for(unsigned int k = 1; k <= degree; k++)
+            {
+                for(unsigned int j = n - 1; j >= k; j--)
+                {
+                    double d = knots.at(j + degree - k + 1) - knots.at(j);
+                    c.at(j) = d > 0 ? (c.at(j) - c.at(j-1))/d : 0;
+                }
+            }
+
+            for(unsigned int i = degree + 1; i < n; i++)
+                jumps.at(i) = std::max(jumps.at(i), std::abs(c.at(i) - c.at(i-1)));
         }
 
-        By(i,0) = it->getY();
-    }
+        return fibers;
+    });
+
+    std::vector<double> weights;
+    for(unsigned int i = degree + 1; i < n; i++)
+        weights.push_back(jumps.at(i)*std::pow(knots.at(i+1) - knots.at(i-1), degree));
+
+    return weights;
 }
 
-bool BSpline::insertKnots(double tau, unsigned int dim, unsigned int multiplicity)
+double BSpline::approximateWithoutKnots(const DenseMatrix &X, const std::vector<unsigned int> &sizes, const std::vector<double> &knots, unsigned int degree, unsigned int dim,
+                                        const std::vector<unsigned int> &removed, DenseMatrix &Y, std::vector<double> &coarseKnots)
 {
-    // Test multiplicity at knot
-    if(basis.getKnotMultiplicity(dim, tau) + multiplicity > basis.getBasisDegree(dim) + 1)
-        return false;
+    // Coarse knot vector, and the knot insertion matrix A back to the current knots
+    coarseKnots.clear();
+    std::vector<double> removedKnots;
+    for(unsigned int i = 0, j = 0; i < knots.size(); i++)
+    {
+        if(j < removed.size() && removed.at(j) == i)
+        {
+            removedKnots.push_back(knots.at(i));
+            j++;
+        }
+        else
+        {
+            coarseKnots.push_back(knots.at(i));
+        }
+    }
 
-    // Insert knots and compute knot insertion matrix
+    BSplineBasis1D coarseBasis(coarseKnots, degree, KnotVectorType::EXPLICIT);
     SparseMatrix A;
-    if(!basis.insertKnots(A, tau, dim, multiplicity))
-        return false;
+    if(!coarseBasis.insertKnots(A, removedKnots))
+    {
+        throw Exception("BSpline::approximateWithoutKnots: Failed to build the knot insertion matrix.");
+    }
 
-    // Update control points
-    assert(A.cols() == coefficients.cols());
-    coefficients = coefficients*A.transpose();
-    knotaverages = knotaverages*A.transpose();
+    // Least squares approximation, from the normal equations A'*A*y = A'*x of each fiber
+    SparseMatrix At = A.transpose();
+    Eigen::SimplicialLDLT<SparseMatrix> ldlt(At*A);
+    if(ldlt.info() != Eigen::Success)
+    {
+        throw Exception("BSpline::approximateWithoutKnots: Failed to factorize the normal equations.");
+    }
 
-    return true;
+    std::vector<unsigned int> coarseSizes = sizes;
+    Y = modeProduct(X, coarseSizes, dim, [&](const DenseMatrix &fibers) -> DenseMatrix { return ldlt.solve(At*fibers); });
+
+    std::vector<unsigned int> fineSizes = coarseSizes;
+    DenseMatrix Z = modeProduct(Y, fineSizes, dim, [&A](const DenseMatrix &fibers) -> DenseMatrix { return A*fibers; });
+
+    return (Z - X).cwiseAbs().maxCoeff();
 }
 
-bool BSpline::refineKnotVectors()
+std::vector<unsigned int> BSpline::numBasisFunctionsPerDimension() const
 {
-    // Compute knot insertion matrix
-    SparseMatrix A;
-    if(!basis.refineKnots(A))
-        return false;
+    std::vector<unsigned int> sizes;
+    for(unsigned int dim = 0; dim < numVariables; dim++)
+        sizes.push_back(basis.numBasisFunctions(dim));
+    return sizes;
+}
 
-    // Update control points
-    assert(A.cols() == coefficients.cols());
-    coefficients = coefficients*A.transpose();
-    knotaverages = knotaverages*A.transpose();
+void BSpline::transformControlPoints(const SparseMatrix &A, unsigned int dim, std::vector<unsigned int> &sizes)
+{
+    assert(sizes.at(dim) == A.cols());
 
-    return true;
+    // The control points as columns of tensors: knot averages and coefficients
+    DenseMatrix controlPoints(knotaverages.cols(), numVariables + coefficients.rows());
+    controlPoints << knotaverages.transpose(), coefficients.transpose();
+
+    controlPoints = modeProduct(controlPoints, sizes, dim, [&A](const DenseMatrix &fibers) -> DenseMatrix { return A*fibers; });
+
+    knotaverages = controlPoints.leftCols(numVariables).transpose();
+    coefficients = controlPoints.rightCols(coefficients.rows()).transpose();
 }
 
-// NOTE: Do this lower in the hierarchy so that all knots can be added at once
 bool BSpline::regularizeKnotVectors(std::vector<double> &lb, std::vector<double> &ub)
 {
     // Add and remove controlpoints and knots to make the b-spline p-regular with support [lb, ub]
     if(!(lb.size() == numVariables && ub.size() == numVariables))
         return false;
 
+    // All knots are inserted at once, with one mode product per dimension (see insertKnots)
+    std::vector< std::vector<double> > knots(numVariables);
+
     for(unsigned int dim = 0; dim < numVariables; dim++)
     {
         unsigned int multiplicityTarget = basis.getBasisDegree(dim) + 1;
 
-        // Inserting many knots at the time (to save number of B-spline coefficient calculations)
-        // NOTE: This method generates knot insertion matrices with more nonzero elements than
-        // the method that inserts one knot at the time. This causes the preallocation of
-        // kronecker product matrices to become too small and the speed deteriorates drastically
-        // in higher dimensions because reallocation is necessary. This can be prevented by
-        // precomputing the number of nonzeros when preallocating memory (see myKroneckerProduct).
         int numKnotsLB = multiplicityTarget - basis.getKnotMultiplicity(dim, lb.at(dim));
         if(numKnotsLB > 0)
-        {
-            if(!insertKnots(lb.at(dim), dim, numKnotsLB))
-                return false;
-        }
+            knots.at(dim).insert(knots.at(dim).end(), numKnotsLB, lb.at(dim));
 
         int numKnotsUB = multiplicityTarget - basis.getKnotMultiplicity(dim, ub.at(dim));
         if(numKnotsUB > 0)
-        {
-            if(!insertKnots(ub.at(dim), dim, numKnotsUB))
-                return false;
-        }
+            knots.at(dim).insert(knots.at(dim).end(), numKnotsUB, ub.at(dim));
 
         // Old insertion method: inserts one knot at the time
 //        while (basis.getKnotMultiplicity(dim, lb.at(dim)) < multiplicityTarget)
@@ -494,7 +844,7 @@ bool BSpline::regularizeKnotVectors(std::vector<double> &lb, std::vector<double>
 //        }
     }
 
-    return true;
+    return insertKnots(knots);
 }
 
 bool BSpline::removeUnsupportedBasisFunctions(std::vector<double> &lb, std::vector<double> &ub)
@@ -502,18 +852,152 @@ bool BSpline::removeUnsupportedBasisFunctions(std::vector<double> &lb, std::vect
     assert(lb.size() == numVariables);
     assert(ub.size() == numVariables);
 
-    SparseMatrix A;
-    if(!basis.reduceSupport(lb, ub, A))
+    std::vector<unsigned int> sizes = numBasisFunctionsPerDimension();
+    std::vector<unsigned int> first, count;
+    if(!basis.reduceSupport(lb, ub, first, count))
         return false;
 
-    if(coefficients.cols() != A.rows())
-        return false;
-
-    // Remove unsupported control points (basis functions)
-    coefficients = coefficients*A;
-    knotaverages = knotaverages*A;
+    // Keep the control points of the retained basis functions, which form a sub-tensor
+    coefficients = selectSubTensor(coefficients, sizes, first, count);
+    knotaverages = selectSubTensor(knotaverages, sizes, first, count);
 
     return true;
 }
 
+/*
+ * The last dimension varies fastest, so each run of count.back() columns is copied as a block.
+ * The cost is proportional to the size of the sub-tensor.
+ */
+template<class Body>
+void BSpline::forEachSubTensorRun(const std::vector<unsigned int> &sizes, const std::vector<unsigned int> &first, const std::vector<unsigned int> &count, Body body)
+{
+    unsigned int numDims = sizes.size();
+    unsigned int last = numDims - 1;
+    unsigned int numRuns = 1;
+    for(unsigned int dim = 0; dim < last; dim++)
+        numRuns *= count.at(dim);
+
+    std::vector<unsigned int> index(numDims, 0); // Index of the run in the sub-tensor
+
+    for(unsigned int run = 0; run < numRuns; run++)
+    {
+        unsigned int start = 0;
+        for(unsigned int dim = 0; dim < numDims; dim++)
+            start = start*sizes.at(dim) + first.at(dim) + (dim < last ? index.at(dim) : 0);
+
+        body(start, run);
+
+        for(int dim = (int)last - 1; dim >= 0; dim--)
+        {
+            if(++index.at(dim) < count.at(dim))
+                break;
+            index.at(dim) = 0;
+        }
+    }
+}
+
+DenseMatrix BSpline::selectSubTensor(const DenseMatrix &M, const std::vector<unsigned int> &sizes, const std::vector<unsigned int> &first, const std::vector<unsigned int> &count)
+{
+    unsigned int runLength = count.back();
+    unsigned int numColumns = 1;
+    for(auto n : count)
+        numColumns *= n;
+
+    DenseMatrix S(M.rows(), numColumns);
+
+    forEachSubTensorRun(sizes, first, count, [&](unsigned int start, unsigned int run)
+    {
+        S.middleCols(run*runLength, runLength) = M.middleCols(start, runLength);
+    });
+
+    return S;
+}
+
+void BSpline::bounds(const std::vector<double> &lb, const std::vector<double> &ub, DenseVector &lower, DenseVector &upper, bool tighten) const
+{
+    if(lb.size() != numVariables || ub.size() != numVariables)
+    {
+        throw Exception("BSpline::bounds: Bounds have wrong dimension.");
+    }
+
+    std::vector<double> sl = basis.getSupportLowerBound();
+    std::vector<double> su = basis.getSupportUpperBound();
+
+    for(unsigned int dim = 0; dim < numVariables; dim++)
+    {
+        if(!(sl.at(dim) <= lb.at(dim) && lb.at(dim) <= ub.at(dim) && ub.at(dim) <= su.at(dim)))
+        {
+            throw Exception("BSpline::bounds: Box is empty or outside the domain.");
+        }
+    }
+
+    std::vector<unsigned int> sizes = numBasisFunctionsPerDimension();
+    std::vector<unsigned int> first, count;
+    basis.indexSupportedBasisFunctions(lb, ub, first, count);
+
+    if(!tighten)
+    {
+        // Scan the coefficients of the sub-tensor in place
+        lower = DenseVector::Constant(coefficients.rows(), std::numeric_limits<double>::infinity());
+        upper = DenseVector::Constant(coefficients.rows(), -std::numeric_limits<double>::infinity());
+
+        unsigned int runLength = count.back();
+        forEachSubTensorRun(sizes, first, count, [&](unsigned int start, unsigned int)
+        {
+            lower = lower.cwiseMin(coefficients.middleCols(start, runLength).rowwise().minCoeff());
+            upper = upper.cwiseMax(coefficients.middleCols(start, runLength).rowwise().maxCoeff());
+        });
+
+        return;
+    }
+
+    // Coefficients of the B-spline reduced to the box, computed mode by mode from the coefficients of the sub-tensor
+    DenseMatrix reduced = selectSubTensor(coefficients, sizes, first, count).transpose();
+
+    for(unsigned int dim = 0; dim < numVariables; dim++)
+    {
+        SparseMatrix R;
+        if(!basis.buildRestrictionMatrix(R, lb.at(dim), ub.at(dim), first.at(dim), count.at(dim), dim))
+        {
+            throw Exception("BSpline::bounds: Failed to restrict the basis to the box.");
+        }
+
+        reduced = modeProduct(reduced, count, dim, [&R](const DenseMatrix &fibers) -> DenseMatrix { return R*fibers; });
+    }
+
+    lower = reduced.colwise().minCoeff().transpose();
+    upper = reduced.colwise().maxCoeff().transpose();
+}
+
+void BSpline::boundsBatch(const DenseMatrix &LB, const DenseMatrix &UB, DenseMatrix &lower, DenseMatrix &upper, bool tighten) const
+{
+    if(LB.cols() != numVariables || UB.cols() != numVariables || LB.rows() != UB.rows())
+    {
+        throw Exception("BSpline::boundsBatch: Boxes have wrong dimension.");
+    }
+
+    lower.resize(LB.rows(), coefficients.rows());
+    upper.resize(LB.rows(), coefficients.rows());
+
+    ThreadPool::getDefault().parallelFor(LB.rows(), 0, [&](unsigned int begin, unsigned int end)
+    {
+        std::vector<double> lb(numVariables), ub(numVariables);
+        DenseVector boxLower, boxUpper;
+
+        for(unsigned int i = begin; i < end; i++)
+        {
+            for(unsigned int dim = 0; dim < numVariables; dim++)
+            {
+                lb.at(dim) = LB(i,dim);
+                ub.at(dim) = UB(i,dim);
+            }
+
+            bounds(lb, ub, boxLower, boxUpper, tighten);
+
+            lower.row(i) = boxLower.transpose();
+            upper.row(i) = boxUpper.transpose();
+        }
+    });
+}
+
 } // namespace MultivariateSplines
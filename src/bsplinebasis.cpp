@@ -12,6 +12,14 @@
 #include "include/mykroneckerproduct.h"
 #include "unsupported/Eigen/KroneckerProduct"
 
+#include <cmath>
+
+// Vectorized batch evaluation is available with GCC and Clang on x86 (the instruction set is checked at runtime)
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    #define MS_BATCH_AVX2
+    #include <immintrin.h>
+#endif
+
 namespace MultivariateSplines
 {
 
@@ -73,6 +81,629 @@ SparseVector BSplineBasis::eval(const DenseVector &x) const
     return tv2;
 }
 
+// Number of basis function values supported at a point, summed over all dimensions
+unsigned int BSplineBasis::numSupportedValues() const
+{
+    unsigned int num = 0;
+    for(unsigned int dim = 0; dim < numVariables; dim++)
+    {
+        num += bases[dim].getBasisDegree() + 1;
+    }
+    return num;
+}
+
+/*
+ * Evaluates the p+1 nonzero univariate basis functions in each dimension.
+ * first[dim] is set to the index of the first supported basis function in dimension dim,
+ * and the values are stored consecutively in values (the values of dimension 0 first).
+ * If useHints is true, first must hold the indices from a previous call at a nearby point,
+ * which are used as starting points for the knot interval searches.
+ */
+void BSplineBasis::evalSupported(const DenseVector &x, int *first, double *values, bool useHints) const
+{
+    for(unsigned int dim = 0; dim < numVariables; dim++)
+    {
+        first[dim] = bases[dim].evaluateNonzero(x(dim), values, useHints ? first[dim] : -1);
+        values += bases[dim].getBasisDegree() + 1;
+    }
+}
+
+/*
+ * Computes sum_i c_i*B_i(x) from the output of evalSupported, where the tensor product basis
+ * functions B_i = B_i0 x ... x B_in and the coefficients c_i are ordered as in eval
+ * (the last variable varies fastest). Only the (p+1)^n coefficients that are supported
+ * at x are visited: the innermost sum runs over the contiguous coefficients in the last
+ * dimension, and is weighted by the product of the basis values in the other dimensions.
+ */
+double BSplineBasis::contractSupported(const int *first, const double *values, const double *coefficients) const
+{
+    unsigned int last = numVariables - 1;
+
+    StackBuffer<int> stride(numVariables);
+    StackBuffer<int> count(numVariables);
+    StackBuffer<int> offset(numVariables);
+    StackBuffer<int> counter(numVariables);
+
+    stride[last] = 1;
+    for(int dim = last; dim > 0; dim--)
+    {
+        stride[dim-1] = stride[dim]*bases[dim].numBasisFunctions();
+    }
+
+    int numValues = 0;
+    for(unsigned int dim = 0; dim < numVariables; dim++)
+    {
+        count[dim] = bases[dim].getBasisDegree() + 1;
+        offset[dim] = numValues;
+        counter[dim] = 0;
+        numValues += count[dim];
+    }
+
+    const double *lastValues = values + offset[last];
+
+    double y = 0;
+
+    while(true)
+    {
+        // Product of basis values and coefficient index for the outer dimensions
+        double weight = 1;
+        int index = first[last];
+        for(unsigned int dim = 0; dim < last; dim++)
+        {
+            weight *= values[offset[dim] + counter[dim]];
+            index += (first[dim] + counter[dim])*stride[dim];
+        }
+
+        // Inner sum over the last dimension
+        double sum = 0;
+        for(int k = 0; k < count[last]; k++)
+        {
+            sum += coefficients[index + k]*lastValues[k];
+        }
+
+        y += weight*sum;
+
+        // Move on to the next combination of supported basis functions in the outer dimensions
+        int dim = (int)last - 1;
+        while(dim >= 0 && ++counter[dim] == count[dim])
+        {
+            counter[dim] = 0;
+            dim--;
+        }
+
+        if(dim < 0)
+        {
+            break;
+        }
+    }
+
+    return y;
+}
+
+/*
+ * As evalSupported, but also evaluates the derivatives of order 1, ..., order of the univariate basis functions.
+ * The table holds one block of (order+1)*(p+1) values per dimension (see BSplineBasis1D::evaluateNonzeroDerivatives),
+ * so it must have room for (order+1)*numSupportedValues() values.
+ */
+void BSplineBasis::evalSupportedDerivatives(const DenseVector &x, unsigned int order, int *first, double *table) const
+{
+    for(unsigned int dim = 0; dim < numVariables; dim++)
+    {
+        first[dim] = bases[dim].evaluateNonzeroDerivatives(x(dim), order, table);
+        table += (order + 1)*(bases[dim].getBasisDegree() + 1);
+    }
+}
+
+/*
+ * Computes the value, the gradient (numVariables values, if order >= 1) and the Hessian
+ * (numVariables x numVariables values stored column by column, if order >= 2) of sum_i c_i*B_i(x)
+ * from the output of evalSupportedDerivatives, in a single pass over the supported coefficients.
+ * For each combination of supported basis functions in the outer dimensions, the products of the
+ * basis values in all but one or two dimensions are formed from prefix and suffix products. They are
+ * then multiplied by the inner sums over the last dimension (of the basis values and their derivatives).
+ * Only the lower triangle of the Hessian is accumulated; the upper triangle is filled in by symmetry.
+ */
+void BSplineBasis::contractSupportedDerivatives(const int *first, const double *table, unsigned int order, const double *coefficients, double &value, double *gradient, double *hessian) const
+{
+    unsigned int last = numVariables - 1;
+
+    StackBuffer<int> stride(numVariables);
+    StackBuffer<int> count(numVariables);
+    StackBuffer<int> offset(numVariables);
+    StackBuffer<int> counter(numVariables);
+    StackBuffer<double> prefix(numVariables + 1);
+    StackBuffer<double> suffix(numVariables + 1);
+
+    stride[last] = 1;
+    for(int dim = last; dim > 0; dim--)
+    {
+        stride[dim-1] = stride[dim]*bases[dim].numBasisFunctions();
+    }
+
+    int tableSize = 0;
+    for(unsigned int dim = 0; dim < numVariables; dim++)
+    {
+        count[dim] = bases[dim].getBasisDegree() + 1;
+        offset[dim] = tableSize;
+        counter[dim] = 0;
+        tableSize += (order + 1)*count[dim];
+    }
+
+    unsigned int n = numVariables;
+
+    value = 0;
+    if(order >= 1)
+    {
+        for(unsigned int dim = 0; dim < n; dim++)
+        {
+            gradient[dim] = 0;
+        }
+    }
+    if(order >= 2)
+    {
+        for(unsigned int i = 0; i < n*n; i++)
+        {
+            hessian[i] = 0;
+        }
+    }
+
+    const double *lastValues = table + offset[last];
+    const double *lastDerivatives = lastValues + count[last];
+    const double *lastSecondDerivatives = lastDerivatives + count[last];
+
+    while(true)
+    {
+        int index = first[last];
+        prefix[0] = 1;
+        for(unsigned int dim = 0; dim < last; dim++)
+        {
+            prefix[dim+1] = prefix[dim]*table[offset[dim] + counter[dim]];
+            index += (first[dim] + counter[dim])*stride[dim];
+        }
+
+        // Inner sums over the last dimension
+        double sumValues = 0;
+        double sumDerivatives = 0;
+        double sumSecondDerivatives = 0;
+        for(int k = 0; k < count[last]; k++)
+        {
+            sumValues += coefficients[index + k]*lastValues[k];
+            if(order >= 1)
+            {
+                sumDerivatives += coefficients[index + k]*lastDerivatives[k];
+            }
+            if(order >= 2)
+            {
+                sumSecondDerivatives += coefficients[index + k]*lastSecondDerivatives[k];
+            }
+        }
+
+        value += prefix[last]*sumValues;
+
+        if(order >= 1)
+        {
+            gradient[last] += prefix[last]*sumDerivatives;
+
+            suffix[last] = 1;
+            for(int dim = last - 1; dim >= 0; dim--)
+            {
+                suffix[dim] = suffix[dim+1]*table[offset[dim] + counter[dim]];
+            }
+
+            for(unsigned int dim = 0; dim < last; dim++)
+            {
+                double derivative = table[offset[dim] + count[dim] + counter[dim]];
+                gradient[dim] += prefix[dim]*derivative*suffix[dim+1]*sumValues;
+            }
+        }
+
+        if(order >= 2)
+        {
+            hessian[last*n + last] += prefix[last]*sumSecondDerivatives;
+
+            for(unsigned int i = 0; i < last; i++)
+            {
+                double derivative = table[offset[i] + count[i] + counter[i]];
+                double secondDerivative = table[offset[i] + 2*count[i] + counter[i]];
+
+                hessian[i*n + i] += prefix[i]*secondDerivative*suffix[i+1]*sumValues;
+                hessian[i*n + last] += prefix[i]*derivative*suffix[i+1]*sumDerivatives;
+
+                // Mixed derivatives in dimensions i < j < last
+                double product = prefix[i]*derivative;
+                for(unsigned int j = i + 1; j < last; j++)
+                {
+                    double derivativeJ = table[offset[j] + count[j] + counter[j]];
+                    hessian[i*n + j] += product*derivativeJ*suffix[j+1]*sumValues;
+                    product *= table[offset[j] + counter[j]];
+                }
+            }
+        }
+
+        int dim = (int)last - 1;
+        while(dim >= 0 && ++counter[dim] == count[dim])
+        {
+            counter[dim] = 0;
+            dim--;
+        }
+
+        if(dim < 0)
+        {
+            break;
+        }
+    }
+
+    if(order >= 2)
+    {
+        for(unsigned int i = 0; i < n; i++)
+        {
+            for(unsigned int j = i + 1; j < n; j++)
+            {
+                hessian[j*n + i] = hessian[i*n + j];
+            }
+        }
+    }
+}
+
+/*
+ * Computes the numOutputs values sum_i c_ki*B_i(x), k = 0, ..., numOutputs-1, from the output of
+ * evalSupported. The coefficients are stored column by column in a numOutputs x numBasisFunctions
+ * matrix, so that the coefficients of all outputs for a basis function are contiguous.
+ * The basis values are visited once, as in the single-output contraction.
+ */
+void BSplineBasis::contractSupported(const int *first, const double *values, const double *coefficients, unsigned int numOutputs, double *y) const
+{
+    unsigned int last = numVariables - 1;
+
+    StackBuffer<int> stride(numVariables);
+    StackBuffer<int> count(numVariables);
+    StackBuffer<int> offset(numVariables);
+    StackBuffer<int> counter(numVariables);
+    StackBuffer<double> sum(numOutputs);
+
+    stride[last] = 1;
+    for(int dim = last; dim > 0; dim--)
+    {
+        stride[dim-1] = stride[dim]*bases[dim].numBasisFunctions();
+    }
+
+    int numValues = 0;
+    for(unsigned int dim = 0; dim < numVariables; dim++)
+    {
+        count[dim] = bases[dim].getBasisDegree() + 1;
+        offset[dim] = numValues;
+        counter[dim] = 0;
+        numValues += count[dim];
+    }
+
+    for(unsigned int k = 0; k < numOutputs; k++)
+    {
+        y[k] = 0;
+    }
+
+    const double *lastValues = values + offset[last];
+
+    while(true)
+    {
+        double weight = 1;
+        int index = first[last];
+        for(unsigned int dim = 0; dim < last; dim++)
+        {
+            weight *= values[offset[dim] + counter[dim]];
+            index += (first[dim] + counter[dim])*stride[dim];
+        }
+
+        for(unsigned int k = 0; k < numOutputs; k++)
+        {
+            sum[k] = 0;
+        }
+
+        for(int j = 0; j < count[last]; j++)
+        {
+            const double *c = coefficients + (index + j)*numOutputs;
+            for(unsigned int k = 0; k < numOutputs; k++)
+            {
+                sum[k] += c[k]*lastValues[j];
+            }
+        }
+
+        for(unsigned int k = 0; k < numOutputs; k++)
+        {
+            y[k] += weight*sum[k];
+        }
+
+        int dim = (int)last - 1;
+        while(dim >= 0 && ++counter[dim] == count[dim])
+        {
+            counter[dim] = 0;
+            dim--;
+        }
+
+        if(dim < 0)
+        {
+            break;
+        }
+    }
+}
+
+/*
+ * Computes the numOutputs values and the numOutputs x numVariables Jacobian (stored column by column)
+ * from the output of evalSupportedDerivatives with order 1, with coefficients stored as in the
+ * multi-output contractSupported. The products of the basis values are formed as in
+ * contractSupportedDerivatives, once for all outputs.
+ */
+void BSplineBasis::contractSupportedJacobian(const int *first, const double *table, const double *coefficients, unsigned int numOutputs, double *y, double *jacobian) const
+{
+    unsigned int last = numVariables - 1;
+    unsigned int m = numOutputs;
+
+    StackBuffer<int> stride(numVariables);
+    StackBuffer<int> count(numVariables);
+    StackBuffer<int> offset(numVariables);
+    StackBuffer<int> counter(numVariables);
+    StackBuffer<double> prefix(numVariables + 1);
+    StackBuffer<double> suffix(numVariables + 1);
+    StackBuffer<double> sumValues(m);
+    StackBuffer<double> sumDerivatives(m);
+
+    stride[last] = 1;
+    for(int dim = last; dim > 0; dim--)
+    {
+        stride[dim-1] = stride[dim]*bases[dim].numBasisFunctions();
+    }
+
+    int tableSize = 0;
+    for(unsigned int dim = 0; dim < numVariables; dim++)
+    {
+        count[dim] = bases[dim].getBasisDegree() + 1;
+        offset[dim] = tableSize;
+        counter[dim] = 0;
+        tableSize += 2*count[dim];
+    }
+
+    for(unsigned int k = 0; k < m; k++)
+    {
+        y[k] = 0;
+    }
+    for(unsigned int i = 0; i < m*numVariables; i++)
+    {
+        jacobian[i] = 0;
+    }
+
+    const double *lastValues = table + offset[last];
+    const double *lastDerivatives = lastValues + count[last];
+
+    while(true)
+    {
+        int index = first[last];
+        prefix[0] = 1;
+        for(unsigned int dim = 0; dim < last; dim++)
+        {
+            prefix[dim+1] = prefix[dim]*table[offset[dim] + counter[dim]];
+            index += (first[dim] + counter[dim])*stride[dim];
+        }
+
+        suffix[last] = 1;
+        for(int dim = last - 1; dim >= 0; dim--)
+        {
+            suffix[dim] = suffix[dim+1]*table[offset[dim] + counter[dim]];
+        }
+
+        // Inner sums over the last dimension
+        for(unsigned int k = 0; k < m; k++)
+        {
+            sumValues[k] = 0;
+            sumDerivatives[k] = 0;
+        }
+
+        for(int j = 0; j < count[last]; j++)
+        {
+            const double *c = coefficients + (index + j)*m;
+            for(unsigned int k = 0; k < m; k++)
+            {
+                sumValues[k] += c[k]*lastValues[j];
+                sumDerivatives[k] += c[k]*lastDerivatives[j];
+            }
+        }
+
+        for(unsigned int k = 0; k < m; k++)
+        {
+            y[k] += prefix[last]*sumValues[k];
+            jacobian[last*m + k] += prefix[last]*sumDerivatives[k];
+        }
+
+        for(unsigned int dim = 0; dim < last; dim++)
+        {
+            double derivative = table[offset[dim] + count[dim] + counter[dim]];
+            double weight = prefix[dim]*derivative*suffix[dim+1];
+            for(unsigned int k = 0; k < m; k++)
+            {
+                jacobian[dim*m + k] += weight*sumValues[k];
+            }
+        }
+
+        int dim = (int)last - 1;
+        while(dim >= 0 && ++counter[dim] == count[dim])
+        {
+            counter[dim] = 0;
+            dim--;
+        }
+
+        if(dim < 0)
+        {
+            break;
+        }
+    }
+}
+
+#ifdef MS_BATCH_AVX2
+/*
+ * Local evaluation at the four points X.row(i), ..., X.row(i+3) using AVX2 instructions.
+ * The lanes of a vector register hold the four points, and the knots and coefficients
+ * are gathered from per-lane indices. The arithmetic is the same as in evalSupported
+ * and contractSupported. The buffers values (four lanes per supported value),
+ * first (four lanes per variable) and counter (one per variable) are used as workspace,
+ * and spans (one per variable) holds the knot interval of the previous point.
+ */
+__attribute__((target("avx2,fma")))
+static void contractFourPointsAVX2(const DenseMatrix &X, unsigned int i, const std::vector<BSplineBasis1D> &bases,
+                                   const int *stride, const int *offset, const double *coefficients, double *y,
+                                   double *values, int *first, int *counter, int *spans)
+{
+    unsigned int numVariables = bases.size();
+    unsigned int last = numVariables - 1;
+
+    // Evaluate the nonzero univariate basis functions with the triangular scheme
+    for(unsigned int dim = 0; dim < numVariables; dim++)
+    {
+        const BSplineBasis1D &basis = bases[dim];
+        const double *knots = basis.getKnotVector().data();
+        int p = basis.getBasisDegree();
+
+        // Consecutive points are often close, so each knot interval search starts
+        // from the interval of the previous point (spans[dim] holds the last one found)
+        double x[4];
+        int span[4];
+        for(unsigned int l = 0; l < 4; l++)
+        {
+            x[l] = X(i+l, dim);
+            basis.supportHack(x[l]);
+            span[l] = basis.indexHalfopenInterval(x[l], spans[dim]);
+            spans[dim] = span[l];
+        }
+
+        __m128i vspan = _mm_loadu_si128((const __m128i*)span);
+        __m256d vx = _mm256_loadu_pd(x);
+        double *v = values + 4*offset[dim];
+
+        _mm256_storeu_pd(v, _mm256_set1_pd(1.0));
+
+        for(int j = 1; j <= p; j++)
+        {
+            __m256d saved = _mm256_setzero_pd();
+
+            for(int r = 0; r < j; r++)
+            {
+                __m256d tRight = _mm256_i32gather_pd(knots, _mm_add_epi32(vspan, _mm_set1_epi32(r+1)), 8);
+                __m256d tLeft = _mm256_i32gather_pd(knots, _mm_add_epi32(vspan, _mm_set1_epi32(r+1-j)), 8);
+
+                __m256d temp = _mm256_div_pd(_mm256_loadu_pd(v + 4*r), _mm256_sub_pd(tRight, tLeft));
+                _mm256_storeu_pd(v + 4*r, _mm256_fmadd_pd(_mm256_sub_pd(tRight, vx), temp, saved));
+                saved = _mm256_mul_pd(_mm256_sub_pd(vx, tLeft), temp);
+            }
+
+            _mm256_storeu_pd(v + 4*j, saved);
+        }
+
+        _mm_storeu_si128((__m128i*)(first + 4*dim), _mm_sub_epi32(vspan, _mm_set1_epi32(p)));
+        counter[dim] = 0;
+    }
+
+    // Contract with the coefficients (see contractSupported)
+    int countLast = bases[last].getBasisDegree() + 1;
+    const double *lastValues = values + 4*offset[last];
+    __m128i firstLast = _mm_loadu_si128((const __m128i*)(first + 4*last));
+
+    __m256d vy = _mm256_setzero_pd();
+
+    while(true)
+    {
+        __m256d weight = _mm256_set1_pd(1.0);
+        __m128i index = firstLast;
+        for(unsigned int dim = 0; dim < last; dim++)
+        {
+            weight = _mm256_mul_pd(weight, _mm256_loadu_pd(values + 4*(offset[dim] + counter[dim])));
+
+            __m128i firstDim = _mm_loadu_si128((const __m128i*)(first + 4*dim));
+            __m128i indexDim = _mm_add_epi32(firstDim, _mm_set1_epi32(counter[dim]));
+            index = _mm_add_epi32(index, _mm_mullo_epi32(indexDim, _mm_set1_epi32(stride[dim])));
+        }
+
+        __m256d sum = _mm256_setzero_pd();
+        for(int k = 0; k < countLast; k++)
+        {
+            __m256d c = _mm256_i32gather_pd(coefficients, _mm_add_epi32(index, _mm_set1_epi32(k)), 8);
+            sum = _mm256_fmadd_pd(c, _mm256_loadu_pd(lastValues + 4*k), sum);
+        }
+
+        vy = _mm256_fmadd_pd(weight, sum, vy);
+
+        int dim = (int)last - 1;
+        while(dim >= 0 && ++counter[dim] == (int)bases[dim].getBasisDegree() + 1)
+        {
+            counter[dim] = 0;
+            dim--;
+        }
+
+        if(dim < 0)
+        {
+            break;
+        }
+    }
+
+    _mm256_storeu_pd(y + i, vy);
+}
+#endif // MS_BATCH_AVX2
+
+void BSplineBasis::contractBatch(const DenseMatrix &X, unsigned int begin, unsigned int end, const double *coefficients, double *y) const
+{
+#ifdef MS_BATCH_AVX2
+    static const bool haveAVX2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"));
+
+    if(haveAVX2 && end - begin >= 4)
+    {
+        StackBuffer<int> stride(numVariables);
+        StackBuffer<int> offset(numVariables);
+        StackBuffer<int> first(4*numVariables);
+        StackBuffer<int> counter(numVariables);
+        StackBuffer<double, 256> values(4*numSupportedValues());
+
+        stride[numVariables-1] = 1;
+        for(int dim = numVariables - 1; dim > 0; dim--)
+        {
+            stride[dim-1] = stride[dim]*bases[dim].numBasisFunctions();
+        }
+
+        int numValues = 0;
+        for(unsigned int dim = 0; dim < numVariables; dim++)
+        {
+            offset[dim] = numValues;
+            numValues += bases[dim].getBasisDegree() + 1;
+        }
+
+        StackBuffer<int> spans(numVariables);
+        for(unsigned int dim = 0; dim < numVariables; dim++)
+        {
+            spans[dim] = -1;
+        }
+
+        for(; begin + 4 <= end; begin += 4)
+        {
+            contractFourPointsAVX2(X, begin, bases, stride.data(), offset.data(), coefficients, y,
+                                   values.data(), first.data(), counter.data(), spans.data());
+        }
+    }
+#endif // MS_BATCH_AVX2
+
+    // Remaining points
+    contractBatchScalar(X, begin, end, coefficients, y);
+}
+
+void BSplineBasis::contractBatchScalar(const DenseMatrix &X, unsigned int begin, unsigned int end, const double *coefficients, double *y) const
+{
+    DenseVector x(numVariables);
+    StackBuffer<int> first(numVariables);
+    StackBuffer<double> values(numSupportedValues());
+
+    for(unsigned int i = begin; i < end; i++)
+    {
+        // The supported basis functions at the previous point are used as hints
+        x = X.row(i).transpose();
+        evalSupported(x, first.data(), values.data(), i > begin);
+        y[i] = contractSupported(first.data(), values.data(), coefficients);
+    }
+}
+
 // Old implementation of Jacobian
 DenseMatrix BSplineBasis::evalBasisJacobianOld(DenseVector &x) const
 {
@@ -223,10 +854,14 @@ SparseMatrix BSplineBasis::evalBasisHessian(DenseVector &x) const
 
 bool BSplineBasis::insertKnots(SparseMatrix &A, double tau, unsigned int dim, unsigned int multiplicity)
 {
+    SparseMatrix Adim;
+    if(!insertKnots(Adim, std::vector<double>(multiplicity, tau), dim))
+        return false;
+
+    // Calculate multivariate knot insertion matrix
     A.resize(1,1);
     A.insert(0,0) = 1;
 
-    // Calculate multivariate knot insertion matrix
     for(unsigned int i = 0; i < numVariables; i++)
     {
         SparseMatrix temp = A;
@@ -234,9 +869,7 @@ bool BSplineBasis::insertKnots(SparseMatrix &A, double tau, unsigned int dim, un
 
         if(i == dim)
         {
-            // Build knot insertion matrix
-            if (!bases.at(i).insertKnots(Ai, tau, multiplicity))
-                return false;
+            Ai = Adim;
         }
         else
         {
@@ -255,21 +888,34 @@ bool BSplineBasis::insertKnots(SparseMatrix &A, double tau, unsigned int dim, un
     return true;
 }
 
+/*
+ * Inserts the knots tau (a knot may be repeated) in dimension dim, and returns the univariate knot insertion
+ * matrix Adim of that dimension. The multivariate knot insertion matrix is I x ... x Adim x ... x I,
+ * so the coefficients are updated by a mode product with Adim (see BSpline::insertKnots).
+ */
+bool BSplineBasis::insertKnots(SparseMatrix &Adim, const std::vector<double> &tau, unsigned int dim)
+{
+    if(dim >= numVariables)
+        return false;
+
+    return bases.at(dim).insertKnots(Adim, tau);
+}
+
 bool BSplineBasis::refineKnots(SparseMatrix &A)
 {
+    std::vector<SparseMatrix> factors;
+    if(!refineKnots(factors))
+        return false;
+
     A.resize(1,1);
     A.insert(0,0) = 1;
 
     for(unsigned int i = 0; i < numVariables; i++)
     {
         SparseMatrix temp = A;
-        SparseMatrix Ai;
-
-        if(!bases.at(i).refineKnots(Ai))
-            return false;
 
-        //A = kroneckerProduct(temp, Ai);
-        myKroneckerProduct(temp,Ai,A);
+        //A = kroneckerProduct(temp, factors.at(i));
+        myKroneckerProduct(temp,factors.at(i),A);
     }
 
     A.makeCompressed();
@@ -277,21 +923,47 @@ bool BSplineBasis::refineKnots(SparseMatrix &A)
     return true;
 }
 
+/*
+ * Refines the knot vectors of all dimensions, and returns the univariate knot insertion matrices
+ * (the multivariate knot insertion matrix is their Kronecker product).
+ */
+bool BSplineBasis::refineKnots(std::vector<SparseMatrix> &A)
+{
+    A.resize(numVariables);
+
+    for(unsigned int i = 0; i < numVariables; i++)
+    {
+        if(!bases.at(i).refineKnots(A.at(i)))
+            return false;
+    }
+
+    return true;
+}
+
 bool BSplineBasis::reduceSupport(std::vector<double>& lb, std::vector<double>& ub, SparseMatrix &A)
 {
     assert(lb.size() == ub.size());
     assert(lb.size() == numVariables);
 
+    std::vector<unsigned int> sizes, first, count;
+    for(unsigned int i = 0; i < numVariables; i++)
+        sizes.push_back(bases.at(i).numBasisFunctions());
+
+    if(!reduceSupport(lb, ub, first, count))
+        return false;
+
     A.resize(1,1);
     A.insert(0,0) = 1;
 
     for(unsigned int i = 0; i < numVariables; i++)
     {
         SparseMatrix temp = A;
-        SparseMatrix Ai;
 
-        if(!bases.at(i).reduceSupport(lb.at(i), ub.at(i), Ai))
-            return false;
+        // Selection matrix of dimension i
+        SparseMatrix Ai(sizes.at(i), count.at(i));
+        Ai.reserve(Eigen::VectorXi::Constant(count.at(i), 1));
+        for(unsigned int j = 0; j < count.at(i); j++)
+            Ai.insert(first.at(i) + j, j) = 1;
 
         //A = kroneckerProduct(temp, Ai);
         myKroneckerProduct(temp, Ai, A);
@@ -302,6 +974,32 @@ bool BSplineBasis::reduceSupport(std::vector<double>& lb, std::vector<double>& u
     return true;
 }
 
+/*
+ * Reduces the support to [lb, ub]. In dimension i, the retained basis functions are the count.at(i)
+ * consecutive basis functions starting at first.at(i), so the retained tensor product basis functions
+ * form a sub-tensor (see BSpline::removeUnsupportedBasisFunctions).
+ * Returns false, and leaves the basis unchanged, if the support cannot be reduced.
+ */
+bool BSplineBasis::reduceSupport(const std::vector<double> &lb, const std::vector<double> &ub, std::vector<unsigned int> &first, std::vector<unsigned int> &count)
+{
+    if(lb.size() != numVariables || ub.size() != numVariables)
+        return false;
+
+    std::vector<BSplineBasis1D> reducedBases = bases;
+    first.resize(numVariables);
+    count.resize(numVariables);
+
+    for(unsigned int i = 0; i < numVariables; i++)
+    {
+        if(!reducedBases.at(i).reduceSupport(lb.at(i), ub.at(i), first.at(i), count.at(i)))
+            return false;
+    }
+
+    bases = reducedBases;
+
+    return true;
+}
+
 unsigned int BSplineBasis::getBasisDegree(unsigned int dim) const
 {
     return bases.at(dim).getBasisDegree();
@@ -322,7 +1020,7 @@ unsigned int BSplineBasis::numBasisFunctions() const
     return prod;
 }
 
-BSplineBasis1D BSplineBasis::getSingleBasis(int dim)
+BSplineBasis1D BSplineBasis::getSingleBasis(int dim) const
 {
     return bases.at(dim);
 }
@@ -385,7 +1083,50 @@ int BSplineBasis::supportedPrInterval() const
     return ret;
 }
 
-bool BSplineBasis::insideSupport(DenseVector &x) const
+/*
+ * The basis functions supported at lb are the first ones that are nonzero on [lb, ub]. The last ones
+ * are those supported just below ub, which excludes basis functions that start at ub. At the end of the
+ * knot vector, the interval lookup runs past the last basis function, so the indices are clamped to it.
+ */
+void BSplineBasis::indexSupportedBasisFunctions(const std::vector<double> &lb, const std::vector<double> &ub, std::vector<unsigned int> &first, std::vector<unsigned int> &count) const
+{
+    if(lb.size() != numVariables || ub.size() != numVariables)
+        throw Exception("BSplineBasis::indexSupportedBasisFunctions: Bounds have wrong dimension.");
+
+    first.resize(numVariables);
+    count.resize(numVariables);
+
+    for(unsigned int i = 0; i < numVariables; i++)
+    {
+        if(!(lb.at(i) <= ub.at(i)))
+            throw Exception("BSplineBasis::indexSupportedBasisFunctions: Lower bound is larger than upper bound.");
+
+        double upper = ub.at(i) > lb.at(i) ? std::nextafter(ub.at(i), lb.at(i)) : ub.at(i);
+
+        std::vector<int> lowerIndices = bases.at(i).indexSupportedBasisfunctions(lb.at(i));
+        std::vector<int> upperIndices = bases.at(i).indexSupportedBasisfunctions(upper);
+
+        if(lowerIndices.empty() || upperIndices.empty())
+            throw Exception("BSplineBasis::indexSupportedBasisFunctions: Bounds outside the support.");
+
+        int lastFunction = bases.at(i).numBasisFunctions() - 1;
+        int lowerIndex = std::min(lowerIndices.front(), lastFunction);
+        int upperIndex = std::min(upperIndices.back(), lastFunction);
+
+        first.at(i) = lowerIndex;
+        count.at(i) = upperIndex - lowerIndex + 1;
+    }
+}
+
+bool BSplineBasis::buildRestrictionMatrix(SparseMatrix &R, double lb, double ub, unsigned int first, unsigned int count, unsigned int dim) const
+{
+    if(dim >= numVariables)
+        throw Exception("BSplineBasis::buildRestrictionMatrix: Invalid dimension.");
+
+    return bases.at(dim).buildRestrictionMatrix(R, lb, ub, first, count);
+}
+
+bool BSplineBasis::insideSupport(const DenseVector &x) const
 {
     if(x.size() != numVariables)
     {
@@ -407,7 +1148,7 @@ std::vector<double> BSplineBasis::getSupportLowerBound() const
     std::vector<double> lb;
     for(unsigned int dim = 0; dim < numVariables; dim++)
     {
-        std::vector<double> knots = bases.at(dim).getKnotVector();
+        const std::vector<double> &knots = bases.at(dim).getKnotVector();
         lb.push_back(knots.front());
     }
     return lb;
@@ -418,7 +1159,7 @@ std::vector<double> BSplineBasis::getSupportUpperBound() const
     std::vector<double> ub;
     for(unsigned int dim = 0; dim < numVariables; dim++)
     {
-        std::vector<double> knots = bases.at(dim).getKnotVector();
+        const std::vector<double> &knots = bases.at(dim).getKnotVector();
         ub.push_back(knots.back());
     }
     return ub;
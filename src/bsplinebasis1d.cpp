@@ -11,6 +11,9 @@
 #include "include/bsplinebasis1d.h"
 #include <iostream>
 #include <algorithm>
+#include <iterator>
+#include <cmath>
+#include <queue>
 
 namespace MultivariateSplines
 {
@@ -48,6 +51,8 @@ BSplineBasis1D::BSplineBasis1D(std::vector<double> &x, unsigned int degree, Knot
 
     assert(degree > 0);
     assert(isKnotVectorRegular());
+
+    initIntervalLookup();
 }
 
 SparseVector BSplineBasis1D::evaluate(double x) const
@@ -56,31 +61,148 @@ SparseVector BSplineBasis1D::evaluate(double x) const
 
     supportHack(x);
 
-    std::vector<int> indexSupported = indexSupportedBasisfunctions(x);
+    if(!insideSupport(x))
+    {
+        return basisvalues;
+    }
 
-    basisvalues.reserve(indexSupported.size());
+    // Write the degree+1 nonzero values straight into the storage of the sparse vector
+    basisvalues.resizeNonZeros(degree+1);
+    int first = evaluateNonzero(x, basisvalues.valuePtr());
 
-    // Iterate through the nonzero basisfunctions and store functionvalues
-    for(auto it = indexSupported.begin(); it != indexSupported.end(); it++)
+    for(unsigned int k = 0; k <= degree; k++)
     {
-        basisvalues.insert(*it) = deBoorCox(x, *it, degree);
+        basisvalues.innerIndexPtr()[k] = first + k;
     }
 
-    // Alternative evaluation using basis matrix
-//    int knotIndex = indexHalfopenInterval(x); // knot index
+    return basisvalues;
+}
+
+/*
+ * Evaluates the degree+1 basis functions that are nonzero at x,
+ * B_(u-p,p)(x), ..., B_(u,p)(x), where u is the knot index and p is the degree.
+ * The values are written to the caller-provided buffer values (of length degree+1).
+ * Returns the index u-p of the first nonzero basis function.
+ * If firstHint >= 0, it is taken as the return value at a nearby point (e.g. from the
+ * previous call in a sequence of queries), which speeds up the knot interval search.
+ */
+int BSplineBasis1D::evaluateNonzero(double x, double *values, int firstHint) const
+{
+    supportHack(x);
 
-//    SparseMatrix basisvalues2 = buildBsplineMatrix(x, knotIndex, 1);
-//    for (int i = 2; i <= basisDegree; i++)
-//    {
-//        SparseMatrix Ri = buildBsplineMatrix(x, knotIndex, i);
-//        basisvalues2 = basisvalues2*Ri;
-//    }
-//    basisvalues2.makeCompressed();
+    int knotIndex = firstHint < 0 ? indexHalfopenInterval(x) : indexHalfopenInterval(x, firstHint + degree);
 
-//    assert(basisvalues2.rows() == 1);
-//    assert(basisvalues2.cols() == basisDegree + 1);
+    deBoorCoxTriangular(x, knotIndex, values);
 
-    return basisvalues;
+    return knotIndex - degree;
+}
+
+/*
+ * Evaluates the derivatives of order 0, 1, ..., order of the degree+1 basis functions
+ * that are nonzero at x, cf. Algorithm A2.3 in Piegl and Tiller (1997).
+ * The kth derivatives D^(k)B_(u-p,p)(x), ..., D^(k)B_(u,p)(x) are written to
+ * derivatives[k*(degree+1)], ..., derivatives[k*(degree+1)+degree],
+ * so the caller must provide a buffer of length (order+1)*(degree+1).
+ * Derivatives of order higher than the degree are zero.
+ * Returns the index u-p of the first nonzero basis function.
+ */
+int BSplineBasis1D::evaluateNonzeroDerivatives(double x, unsigned int order, double *derivatives) const
+{
+    supportHack(x);
+
+    int u = indexHalfopenInterval(x);
+    int p = degree;
+    int cols = p + 1;
+
+    // Basis values of all degrees (upper triangle) and knot differences (lower triangle)
+    StackBuffer<double> ndu(cols*cols);
+    ndu[0] = 1;
+
+    for(int j = 1; j <= p; j++)
+    {
+        double saved = 0;
+
+        for(int r = 0; r < j; r++)
+        {
+            double tRight = knots[u+r+1];
+            double tLeft = knots[u+r+1-j];
+
+            ndu[j*cols + r] = tRight - tLeft;
+            double temp = ndu[r*cols + j-1]/ndu[j*cols + r];
+            ndu[r*cols + j] = saved + (tRight - x)*temp;
+            saved = (x - tLeft)*temp;
+        }
+
+        ndu[j*cols + j] = saved;
+    }
+
+    for(int j = 0; j <= p; j++)
+    {
+        derivatives[j] = ndu[j*cols + p];
+    }
+
+    // Derivatives from differences of the lower degree basis values (two alternating rows of coefficients a)
+    int n = std::min((int)order, p);
+    StackBuffer<double> a(2*cols);
+
+    for(int r = 0; r <= p; r++)
+    {
+        int s1 = 0;
+        int s2 = 1;
+        a[0] = 1;
+
+        for(int k = 1; k <= n; k++)
+        {
+            double d = 0;
+            int rk = r - k;
+            int pk = p - k;
+
+            if(r >= k)
+            {
+                a[s2*cols] = a[s1*cols]/ndu[(pk+1)*cols + rk];
+                d = a[s2*cols]*ndu[rk*cols + pk];
+            }
+
+            int j1 = (rk >= -1) ? 1 : -rk;
+            int j2 = (r - 1 <= pk) ? k - 1 : p - r;
+
+            for(int j = j1; j <= j2; j++)
+            {
+                a[s2*cols + j] = (a[s1*cols + j] - a[s1*cols + j-1])/ndu[(pk+1)*cols + rk+j];
+                d += a[s2*cols + j]*ndu[(rk+j)*cols + pk];
+            }
+
+            if(r <= pk)
+            {
+                a[s2*cols + k] = -a[s1*cols + k-1]/ndu[(pk+1)*cols + r];
+                d += a[s2*cols + k]*ndu[r*cols + pk];
+            }
+
+            derivatives[k*cols + r] = d;
+            std::swap(s1, s2);
+        }
+    }
+
+    // Multiply by the factors p!/(p-k)!
+    double factor = p;
+    for(int k = 1; k <= n; k++)
+    {
+        for(int j = 0; j <= p; j++)
+        {
+            derivatives[k*cols + j] *= factor;
+        }
+        factor *= (p - k);
+    }
+
+    for(int k = n + 1; k <= (int)order; k++)
+    {
+        for(int j = 0; j <= p; j++)
+        {
+            derivatives[k*cols + j] = 0;
+        }
+    }
+
+    return u - p;
 }
 
 SparseVector BSplineBasis1D::evaluateDerivative(double x, int r) const
@@ -255,6 +377,36 @@ double BSplineBasis1D::deBoorCox(double x, int i, int k) const
     }
 }
 
+/*
+ * Non-recursive evaluation of the degree+1 basis functions that are nonzero
+ * on the knot interval [knots(u), knots(u+1)), cf. Algorithm A2.2 in
+ * Piegl and Tiller (1997). The triangular scheme raises the degree one step
+ * at the time and requires O(p^2) operations, compared to O(p*2^p) for
+ * evaluating each basis function with the recursive deBoorCox.
+ * Assumes that knots(u) <= x < knots(u+1).
+ */
+void BSplineBasis1D::deBoorCoxTriangular(double x, int u, double *values) const
+{
+    values[0] = 1;
+
+    for(unsigned int j = 1; j <= degree; j++)
+    {
+        double saved = 0;
+
+        for(unsigned int r = 0; r < j; r++)
+        {
+            double tRight = knots[u+r+1];
+            double tLeft = knots[u+r+1-j];
+
+            double temp = values[r]/(tRight - tLeft);
+            values[r] = saved + (tRight - x)*temp;
+            saved = (x - tLeft)*temp;
+        }
+
+        values[j] = saved;
+    }
+}
+
 double BSplineBasis1D::deBoorCoxCoeff(double x, double x_min, double x_max) const
 {
     if(x_min < x_max && x_min <= x && x <= x_max)
@@ -267,15 +419,36 @@ double BSplineBasis1D::deBoorCoxCoeff(double x, double x_min, double x_max) cons
 // Insert knots and compute knot insertion matrix (to update control points)
 bool BSplineBasis1D::insertKnots(SparseMatrix &A, double tau, unsigned int multiplicity)
 {
-    if(!insideSupport(tau) || knotMultiplicity(tau) + multiplicity > degree + 1)
-        return false;
+    return insertKnots(A, std::vector<double>(multiplicity, tau));
+}
+
+/*
+ * Inserts all knots in newKnots (a knot may be repeated) at once, and computes the knot insertion matrix
+ * from the old to the new knot vector. Returns false, and leaves the knots unchanged, if a knot is outside
+ * the support or would get a multiplicity larger than degree+1.
+ */
+bool BSplineBasis1D::insertKnots(SparseMatrix &A, const std::vector<double> &newKnots)
+{
+    for(auto tau : newKnots)
+    {
+        if(!insideSupport(tau))
+            return false;
+    }
 
     // New knot vector
-    int index = indexHalfopenInterval(tau);
+    std::vector<double> sortedKnots = newKnots;
+    std::sort(sortedKnots.begin(), sortedKnots.end());
 
-    std::vector<double> extKnots = knots;
-    for(unsigned int i = 0; i < multiplicity; i++)
-        extKnots.insert(extKnots.begin()+index+1, tau);
+    std::vector<double> extKnots;
+    extKnots.reserve(knots.size() + newKnots.size());
+    std::merge(knots.begin(), knots.end(), sortedKnots.begin(), sortedKnots.end(), std::back_inserter(extKnots));
+
+    for(auto tau : sortedKnots)
+    {
+        auto range = std::equal_range(extKnots.begin(), extKnots.end(), tau);
+        if(range.second - range.first > (int)degree + 1)
+            return false;
+    }
 
     assert(isKnotVectorRegular(extKnots));
 
@@ -285,23 +458,60 @@ bool BSplineBasis1D::insertKnots(SparseMatrix &A, double tau, unsigned int multi
 
     // Update knots
     knots = extKnots;
+    initIntervalLookup();
 
     return true;
 }
 
 bool BSplineBasis1D::refineKnots(SparseMatrix &A)
 {
-    // Build refine knot vector
-    std::vector<double> refinedKnots = knots;
+    return refineKnots(A, targetNumBasisfunctions);
+}
+
+/*
+ * Inserts knots until there are numBasisFunctions basis functions, each new knot bisecting the longest
+ * knot interval (the leftmost one of equal length). The intervals are kept in a heap, so that n new
+ * knots cost O(n log n), and the new knots are merged into the knot vector at once.
+ */
+bool BSplineBasis1D::refineKnots(SparseMatrix &A, unsigned int numBasisFunctions)
+{
+    // Knot intervals (left, right), longest first
+    typedef std::pair<double, double> Interval;
+    auto shorter = [](const Interval &a, const Interval &b)
+    {
+        double lengthA = a.second - a.first;
+        double lengthB = b.second - b.first;
+        return lengthA < lengthB || (lengthA == lengthB && a.first > b.first);
+    };
+    std::priority_queue<Interval, std::vector<Interval>, decltype(shorter)> intervals(shorter);
+
+    for(unsigned int i = 0; i + 1 < knots.size(); i++)
+    {
+        if(knots.at(i) < knots.at(i+1))
+            intervals.push(Interval(knots.at(i), knots.at(i+1)));
+    }
 
-    unsigned int targetNumKnots = targetNumBasisfunctions + degree + 1;
-    while(refinedKnots.size() < targetNumKnots)
+    unsigned int targetNumKnots = numBasisFunctions + degree + 1;
+    std::vector<double> newKnots;
+
+    while(knots.size() + newKnots.size() < targetNumKnots && !intervals.empty())
     {
-        int index = indexLongestInterval(refinedKnots);
-        double newKnot = (refinedKnots.at(index) + refinedKnots.at(index+1))/2.0;
-        refinedKnots.insert(lower_bound(refinedKnots.begin(), refinedKnots.end(), newKnot), newKnot);
+        Interval longest = intervals.top();
+        intervals.pop();
+
+        double newKnot = (longest.first + longest.second)/2.0;
+        newKnots.push_back(newKnot);
+
+        intervals.push(Interval(longest.first, newKnot));
+        intervals.push(Interval(newKnot, longest.second));
     }
 
+    std::sort(newKnots.begin(), newKnots.end());
+
+    std::vector<double> refinedKnots;
+    refinedKnots.reserve(knots.size() + newKnots.size());
+    std::merge(knots.begin(), knots.end(), newKnots.begin(), newKnots.end(), std::back_inserter(refinedKnots));
+
     assert(isKnotVectorRegular(refinedKnots) && isRefinement(refinedKnots));
 
     // Return knot insertion matrix
@@ -312,10 +522,19 @@ bool BSplineBasis1D::refineKnots(SparseMatrix &A)
 
     // Update knots
     knots = refinedKnots;
+    initIntervalLookup();
 
     return true;
 }
 
+/*
+ * Knot insertion matrix by the Oslo algorithm. Row i holds the discrete B-splines alpha_j(i), which express
+ * basis function i of the refined knots tau in the old basis functions j = mu-p, ..., mu, where
+ * knots(mu) <= tau(i) < knots(mu+1). They are computed as the product R_1(tau(i+1))*...*R_p(tau(i+p)) of the
+ * bidiagonal basis matrices (see buildBasisMatrix), with the same arithmetic, in a buffer of degree+1 values.
+ * mu is nondecreasing in i, so it is found by a single pass over the knots. The rows are written in order
+ * into the compressed storage of a row-major matrix, which is converted to A.
+ */
 bool BSplineBasis1D::buildKnotInsertionMatrix(SparseMatrix &A, const std::vector<double> &refinedKnots) const
 {
     if (!isRefinement(refinedKnots))
@@ -323,44 +542,56 @@ bool BSplineBasis1D::buildKnotInsertionMatrix(SparseMatrix &A, const std::vector
         throw Exception("BSplineBasis1D::buildKnotInsertionMatrix: New knot vector is not a proper refinement of the old!");
     }
 
-    std::vector<double> knotsAug = refinedKnots;
+    const std::vector<double> &tau = refinedKnots;
     unsigned int n = knots.size() - degree - 1;
-    unsigned int m = knotsAug.size() - degree - 1;
+    unsigned int m = tau.size() - degree - 1;
+
+    Eigen::SparseMatrix<double, Eigen::RowMajor> R(m, n);
+    R.reserve(m*(degree+1));
 
-    //SparseMatrix A(m,n);
-    A.resize(m,n);
-    A.reserve(Eigen::VectorXi::Constant(n,degree+1));
+    std::vector<double> alpha(degree+1);
+    unsigned int mu = degree;
 
-    // Build A row-by-row
     for(unsigned int i = 0; i < m; i++)
     {
-        int u = indexHalfopenInterval(knotsAug.at(i));
+        while(mu + 1 < n && knots[mu+1] <= tau[i])
+            mu++;
 
-        // Assuming that p > 0
-        SparseMatrix R(1,1);
-        R.insert(0,0) = 1;
-        for(unsigned int j = 1; j <= degree; j++)
+        alpha[0] = 1;
+        for(unsigned int k = 1; k <= degree; k++)
         {
-            SparseMatrix Ri = buildBasisMatrix(knotsAug.at(i+j), u, j);
-            R = R*Ri;
-        }
+            double x = tau[i+k];
+            alpha[k] = 0;
 
-        // Size check
-        if(R.rows() != 1 || R.cols() != degree+1)
-        {
-            throw Exception("BSplineBasis1D::buildKnotInsertionMatrix: Incorrect matrix dimensions!");
+            // Multiply by R_k(x) from the right, from the last column
+            for(int r = k - 1; r >= 0; r--)
+            {
+                double right = knots[mu+1+r];
+                double left = knots[mu+1+r-k];
+                double dk = right - left;
+
+                if(dk == 0)
+                {
+                    alpha[r] = 0;
+                    continue;
+                }
+
+                alpha[r+1] = alpha[r]*((x - left)/dk) + alpha[r+1];
+                alpha[r] = alpha[r]*((right - x)/dk);
+            }
         }
 
-        // Insert row values
-        int j = u-degree; // First insertion index
-        for(int k = 0; k < R.outerSize(); ++k)
-        for(SparseMatrix::InnerIterator it(R,k); it; ++it)
+        R.startVec(i);
+        for(unsigned int r = 0; r <= degree; r++)
         {
-            A.insert(i,j+it.col()) = it.value();
+            if(alpha[r] != 0)
+                R.insertBack(i, mu - degree + r) = alpha[r];
         }
     }
 
-    A.makeCompressed();
+    R.finalize();
+
+    A = R;
 
     return true;
 }
@@ -389,6 +620,20 @@ int BSplineBasis1D::indexHalfopenInterval(double x) const
         throw Exception("BSplineBasis1D::indexHalfopenInterval: x outside knot interval!");
     }
 
+    // Direct computation for uniform knots, corrected for round-off
+    if(uniformKnots && x < knots.back())
+    {
+        int index = uniformFirst + (int)((x - knots.front())*uniformInverseSpacing);
+        index = std::min(index, uniformLast - 1);
+
+        while(x < knots[index])
+            index--;
+        while(x >= knots[index+1])
+            index++;
+
+        return index;
+    }
+
     // Find first knot that is larger than x
     std::vector<double>::const_iterator it = std::upper_bound(knots.begin(), knots.end(), x);
 
@@ -397,7 +642,82 @@ int BSplineBasis1D::indexHalfopenInterval(double x) const
     return index - 1;
 }
 
+/*
+ * As indexHalfopenInterval(x), but first checks if x is in the knot interval hint
+ * or in one of its neighbours. Suitable for sequences of nearby points
+ * (e.g. from time-stepping), where hint is the index returned for the previous point.
+ */
+int BSplineBasis1D::indexHalfopenInterval(double x, int hint) const
+{
+    int numKnots = knots.size();
+
+    if(hint >= 0 && hint + 1 < numKnots && knots[hint] <= x)
+    {
+        if(x < knots[hint+1])
+            return hint;
+        if(hint + 2 < numKnots && x < knots[hint+2])
+            return hint + 1;
+    }
+    else if(hint >= 1 && hint < numKnots && knots[hint-1] <= x && x < knots[hint])
+    {
+        return hint - 1;
+    }
+
+    return indexHalfopenInterval(x);
+}
+
+/*
+ * Computes indices(i) = indexHalfopenInterval(x(i)) for all i.
+ * For increasing x, the knot intervals are found by a single sweep over the knots,
+ * which requires O(x.size() + knots.size()) operations. Points that are smaller
+ * than their predecessor are looked up individually.
+ */
+void BSplineBasis1D::indexHalfopenIntervals(const std::vector<double> &x, std::vector<int> &indices) const
+{
+    indices.resize(x.size());
+
+    int numKnots = knots.size();
+    int index = -1;
+
+    for(unsigned int i = 0; i < x.size(); i++)
+    {
+        if(index < 0 || x[i] < knots[index] || x[i] > knots.back())
+        {
+            index = indexHalfopenInterval(x[i]);
+        }
+        else
+        {
+            while(index + 1 < numKnots && x[i] >= knots[index+1])
+                index++;
+        }
+
+        indices[i] = index;
+    }
+}
+
 bool BSplineBasis1D::reduceSupport(double lb, double ub, SparseMatrix &A)
+{
+    unsigned int n_old = numBasisFunctions();
+    unsigned int first, count;
+
+    if(!reduceSupport(lb, ub, first, count))
+        return false;
+
+    // Selection matrix
+    A.resize(n_old, count);
+    A.reserve(Eigen::VectorXi::Constant(count, 1));
+    for(unsigned int i = 0; i < count; i++)
+        A.insert(first + i, i) = 1;
+    A.makeCompressed();
+
+    return true;
+}
+
+/*
+ * Reduces the support to [lb, ub]. The retained basis functions are the numRetained consecutive
+ * basis functions starting at index first of the old basis.
+ */
+bool BSplineBasis1D::reduceSupport(double lb, double ub, unsigned int &first, unsigned int &numRetained)
 {
     // Check bounds
     if(lb < knots.front() || ub > knots.back())
@@ -444,18 +764,67 @@ bool BSplineBasis1D::reduceSupport(double lb, double ub, SparseMatrix &A)
     std::vector<double> si;
     si.insert(si.begin(), knots.begin()+index_lower, knots.begin()+index_upper+k+1);
 
-    // Construct selection matrix A
+    // Retained basis functions
     int n_old = knots.size()-k; // Current number of basis functions
     int n_new = si.size()-k; // Number of basis functions after update
 
     if (n_old < n_new) return false;
 
-    DenseMatrix Ad = DenseMatrix::Zero(n_old, n_new);
-    Ad.block(index_lower, 0, n_new, n_new) = DenseMatrix::Identity(n_new, n_new);
-    A = Ad.sparseView();
+    first = index_lower;
+    numRetained = n_new;
 
     // Update knots
     knots = si;
+    initIntervalLookup();
+
+    return true;
+}
+
+/*
+ * The knots at lb and ub are given multiplicity degree+1 in a copy of the basis, and the rows of the knot
+ * insertion matrix of the basis functions on [lb, ub] are returned. Each of these basis functions has a
+ * support inside the support of the old basis functions it is combined from, so only the columns first,
+ * ..., first+count-1 are nonzero. For lb = ub, R holds the basis values at lb.
+ */
+bool BSplineBasis1D::buildRestrictionMatrix(SparseMatrix &R, double lb, double ub, unsigned int first, unsigned int count) const
+{
+    if(lb > ub || !insideSupport(lb) || !insideSupport(ub) || first + count > numBasisFunctions())
+        return false;
+
+    if(lb == ub)
+    {
+        SparseVector values = evaluate(lb);
+        int begin = first, end = first + count;
+
+        R.resize(1, count);
+        for(SparseVector::InnerIterator it(values); it; ++it)
+        {
+            if(begin <= it.index() && it.index() < end)
+                R.insert(0, it.index() - begin) = it.value();
+        }
+        R.makeCompressed();
+
+        return true;
+    }
+
+    std::vector<double> newKnots;
+    unsigned int multiplicityLB = knotMultiplicity(lb);
+    unsigned int multiplicityUB = knotMultiplicity(ub);
+    if(multiplicityLB < degree + 1)
+        newKnots.insert(newKnots.end(), degree + 1 - multiplicityLB, lb);
+    if(multiplicityUB < degree + 1)
+        newKnots.insert(newKnots.end(), degree + 1 - multiplicityUB, ub);
+
+    BSplineBasis1D refined = *this;
+    SparseMatrix A;
+    if(!refined.insertKnots(A, newKnots))
+        return false;
+
+    unsigned int refinedFirst, refinedCount;
+    if(!refined.reduceSupport(lb, ub, refinedFirst, refinedCount))
+        return false;
+
+    R = A.block(refinedFirst, first, refinedCount, count);
 
     return true;
 }
@@ -561,11 +930,13 @@ bool BSplineBasis1D::isKnotVectorRegular(const std::vector<double> &vec) const
     if(!std::is_sorted(vec.begin(), vec.end()))
         return false;
 
-    // Check multiplicity of knots
-    for(std::vector<double>::const_iterator it = vec.begin(); it != vec.end(); ++it)
+    // Check multiplicity of knots (equal knots are adjacent in a sorted vector)
+    for(auto it = vec.begin(); it != vec.end(); )
     {
-        if(count(vec.begin(), vec.end(), *it) > degree+1)
+        auto next = std::upper_bound(it, vec.end(), *it);
+        if(next - it > degree+1)
             return false;
+        it = next;
     }
 
     return true;
@@ -581,13 +952,9 @@ bool BSplineBasis1D::isRefinement(const std::vector<double> &refinedKnots) const
     if(!isKnotVectorRegular(refinedKnots))
         return false;
 
-    // Check that each element in knots occurs at least as many times in refinedKnots
-    for(std::vector<double>::const_iterator it = knots.begin() ; it != knots.end(); ++it)
-    {
-        int m_tau = count(knots.begin(), knots.end(), *it);
-        int m_t = count(refinedKnots.begin(), refinedKnots.end(), *it);
-        if (m_t < m_tau) return false;
-    }
+    // Check that each element in knots occurs at least as many times in refinedKnots (both are sorted)
+    if(!std::includes(refinedKnots.begin(), refinedKnots.end(), knots.begin(), knots.end()))
+        return false;
 
     // Check that range is not changed
     if(knots.front() != refinedKnots.front()) return false;
@@ -750,6 +1117,39 @@ std::vector<double> BSplineBasis1D::knotVectorFree(std::vector<double> &X) const
     return knots;
 }
 
+/*
+ * Checks if the distinct knots are uniformly spaced, allowing repeated knots only at the ends
+ * (as for KnotVectorType::EQUIDISTANT). In that case, indexHalfopenInterval computes the knot
+ * interval from the distance to the first knot instead of searching the knot vector.
+ */
+void BSplineBasis1D::initIntervalLookup()
+{
+    uniformKnots = false;
+
+    if(knots.size() < 2 || !(knots.front() < knots.back()))
+    {
+        return;
+    }
+
+    uniformFirst = std::upper_bound(knots.begin(), knots.end(), knots.front()) - knots.begin() - 1;
+    uniformLast = std::lower_bound(knots.begin(), knots.end(), knots.back()) - knots.begin();
+
+    int numIntervals = uniformLast - uniformFirst;
+    double spacing = (knots.back() - knots.front())/numIntervals;
+
+    for(int i = uniformFirst; i <= uniformLast; i++)
+    {
+        double uniformKnot = knots.front() + (i - uniformFirst)*spacing;
+        if(std::abs(knots[i] - uniformKnot) > 1e-6*spacing)
+        {
+            return;
+        }
+    }
+
+    uniformInverseSpacing = 1.0/spacing;
+    uniformKnots = true;
+}
+
 std::vector<double> BSplineBasis1D::linspace(double start, double stop, unsigned int points) const
 {
     std::vector<double> ret;
@@ -0,0 +1,734 @@
+/*
+ * This file is part of the Multivariate Splines library.
+ * Copyright (C) 2012 Bjarne Grimstad (bjarne.grimstad@gmail.com)
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+
+#include "include/bsplinefitter.h"
+#include "include/pspline.h"
+
+#include <iostream>
+#include <functional>
+#include <random>
+#include <algorithm>
+
+namespace MultivariateSplines
+{
+
+// Basis with knot vectors for free end conditions on the grid of the samples (as used by BSpline and PSpline)
+static BSplineBasis freeBasis(const DataTable &samples, unsigned int degree)
+{
+    std::vector< std::vector<double> > xdata = samples.getTableX();
+    std::vector<unsigned int> basisDegrees(samples.getNumVariables(), degree);
+    return BSplineBasis(xdata, basisDegrees, KnotVectorType::FREE);
+}
+
+static unsigned int basisDegree(BSplineType type)
+{
+    if(type == BSplineType::LINEAR)
+    {
+        return 1;
+    }
+    else if(type == BSplineType::QUADRATIC_FREE)
+    {
+        return 2;
+    }
+    return 3;
+}
+
+BSplineFitter::BSplineFitter(const DataTable &samples, BSplineType type)
+    : BSplineFitter(samples, freeBasis(samples, basisDegree(type)))
+{
+}
+
+BSplineFitter::BSplineFitter(const DataTable &samples, double lambda)
+    : BSplineFitter(samples, freeBasis(samples, 3), lambda)
+{
+}
+
+BSplineFitter::BSplineFitter(const DataTable &samples, const BSplineBasis &basis)
+    : basis(basis),
+      lambda(0),
+      differencePenalty(false)
+{
+    factorize(samples, nullptr);
+}
+
+BSplineFitter::BSplineFitter(const DataTable &samples, const BSplineBasis &basis, double lambda)
+    : basis(basis),
+      lambda(lambda),
+      differencePenalty(true)
+{
+    factorize(samples, nullptr);
+}
+
+BSplineFitter::BSplineFitter(const DataTable &samples, const BSplineBasis &basis, const SparseMatrix &penalty, double lambda)
+    : basis(basis),
+      lambda(lambda),
+      differencePenalty(false)
+{
+    factorize(samples, &penalty);
+}
+
+/*
+ * Sets up and factorizes the left-hand side of the equations Lc = R for the control coefficients:
+ * L = B and R = y for interpolation, and L = B'*B + lambda*D'*D and R = B'*y for a penalized fit,
+ * where B holds the basis functions evaluated at the samples and D is the penalty matrix
+ * (the second-order difference matrix of PSpline if differencePenalty is set).
+ */
+void BSplineFitter::factorize(const DataTable &samples, const SparseMatrix *penalty)
+{
+    if(!samples.isGridComplete())
+    {
+        throw Exception("BSplineFitter::factorize: Cannot fit B-spline to irregular (incomplete) grid.");
+    }
+
+    numSamples = samples.getNumSamples();
+    grid = samples.getGrid();
+    penalized = (penalty != nullptr || differencePenalty);
+
+    // Fits on a grid without duplicate samples do not require B
+    if(!penalized && factorizeKronecker(samples))
+    {
+        return;
+    }
+
+    if(differencePenalty && factorizeGLAM(samples))
+    {
+        return;
+    }
+
+    computeBasisFunctionMatrix(basis, samples, collocation);
+
+    SparseMatrix D;
+    if(differencePenalty)
+    {
+        PSpline::getSecondOrderFiniteDifferenceMatrix(basis, D);
+        penalty = &D;
+    }
+
+    if(penalized)
+    {
+        lhs = collocation.transpose()*collocation + lambda*penalty->transpose()*(*penalty);
+    }
+    else
+    {
+        lhs = collocation;
+        collocation.resize(0, 0);
+    }
+
+    // The left-hand side of a penalized fit is symmetric positive definite (see selectLinearSolver).
+    // If a sparse factorization fails, the next solver in line is tried.
+    solverType = selectLinearSolver(lhs, penalized);
+
+    if(solverType == LinearSolverType::SPARSE_LDLT)
+    {
+        sparseLDLT = std::make_shared< Eigen::SimplicialLDLT<SparseMatrix> >(lhs);
+
+        if(sparseLDLT->info() != Eigen::Success)
+        {
+            sparseLDLT.reset();
+            solverType = LinearSolverType::SPARSE_LU;
+        }
+    }
+
+    if(solverType == LinearSolverType::SPARSE_CG)
+    {
+        sparseCG = std::make_shared<PreconditionedCG>();
+        sparseCG->setTolerance(tol);
+        sparseCG->compute(lhs);
+
+        if(sparseCG->info() != Eigen::Success)
+        {
+            sparseCG.reset();
+            solverType = LinearSolverType::SPARSE_LU;
+        }
+    }
+
+    if(solverType == LinearSolverType::SPARSE_LU)
+    {
+        sparseLU = std::make_shared< Eigen::SparseLU<SparseMatrix> >();
+        sparseLU->analyzePattern(lhs);
+        sparseLU->factorize(lhs);
+
+        if(sparseLU->info() != Eigen::Success)
+        {
+            sparseLU.reset();
+            solverType = LinearSolverType::DENSE_QR;
+        }
+    }
+
+    if(solverType == LinearSolverType::SPARSE_QR)
+    {
+        sparseQR = std::make_shared< Eigen::SparseQR<SparseMatrix, Eigen::COLAMDOrdering<int> > >(lhs);
+
+        if(sparseQR->info() != Eigen::Success)
+        {
+            sparseQR.reset();
+            solverType = LinearSolverType::DENSE_QR;
+        }
+    }
+
+    if(solverType == LinearSolverType::DENSE_QR)
+    {
+        denseQR = std::make_shared< Eigen::ColPivHouseholderQR<DenseMatrix> >(lhs.toDense());
+    }
+
+#ifndef NDEBUG
+    std::cout << "Computing B-spline control points using solver " << (int)solverType << "." << std::endl;
+#endif // NDEBUG
+}
+
+/*
+ * On a complete grid where each grid point is sampled once, the samples (ordered lexicographically
+ * in x, like the basis functions) give a collocation matrix B = B_0 x ... x B_(n-1), where B_d
+ * holds the univariate basis functions of dimension d evaluated at the grid values of dimension d.
+ * The univariate matrices are factorized by a KroneckerSolver.
+ * Returns false if the samples are not such a grid, or if a factorization fails.
+ */
+bool BSplineFitter::factorizeKronecker(const DataTable &samples)
+{
+    std::vector<SparseMatrix> factors;
+    if(!computeUnivariateCollocationMatrices(samples, factors))
+    {
+        return false;
+    }
+
+    for(auto &factor : factors)
+    {
+        if(factor.rows() != factor.cols())
+        {
+            return false;
+        }
+    }
+
+    kroneckerSolver = std::make_shared<KroneckerSolver>(factors);
+
+    if(!kroneckerSolver->isFactorized())
+    {
+        kroneckerSolver.reset();
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * On a complete grid where each grid point is sampled once (see factorizeKronecker), B'*B is the
+ * Kronecker product of the univariate matrices B_d'*B_d, and the second-order difference penalty is
+ * D'*D = sum_d I x ... x D_d'*D_d x ... x I, where D_d is the univariate second-order difference matrix.
+ * The equations are then solved by a PenalizedKroneckerSolver, and the right-hand side B'*y is computed
+ * mode by mode. Returns false if the samples are not such a grid, or if the preconditioner cannot be factorized.
+ */
+bool BSplineFitter::factorizeGLAM(const DataTable &samples)
+{
+    if(!computeUnivariateCollocationMatrices(samples, univariateCollocation))
+    {
+        return false;
+    }
+
+    std::vector<SparseMatrix> gramFactors, penaltyFactors;
+    for(auto &Bd : univariateCollocation)
+    {
+        unsigned int n = Bd.cols();
+
+        SparseMatrix Dd(n > 2 ? n - 2 : 0, n);
+        Dd.reserve(Eigen::VectorXi::Constant(n, 3));
+        for(unsigned int i = 0; i + 2 < n; i++)
+        {
+            Dd.insert(i, i) = 1;
+            Dd.insert(i, i + 1) = -2;
+            Dd.insert(i, i + 2) = 1;
+        }
+        Dd.makeCompressed();
+
+        gramFactors.push_back(SparseMatrix(Bd.transpose())*Bd);
+        penaltyFactors.push_back(SparseMatrix(Dd.transpose())*Dd);
+    }
+
+    penalizedKroneckerSolver = std::make_shared<PenalizedKroneckerSolver>(gramFactors, penaltyFactors, lambda);
+
+    if(!penalizedKroneckerSolver->isFactorized())
+    {
+        penalizedKroneckerSolver.reset();
+        univariateCollocation.clear();
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Computes the univariate collocation matrices B_d, which hold the basis functions of dimension d
+ * evaluated at the grid values of dimension d. Returns false unless each grid point is sampled once,
+ * in which case the collocation matrix of the samples (ordered lexicographically in x, like the basis
+ * functions) is B = B_0 x ... x B_(n-1).
+ */
+bool BSplineFitter::computeUnivariateCollocationMatrices(const DataTable &samples, std::vector<SparseMatrix> &factors) const
+{
+    unsigned int numVariables = samples.getNumVariables();
+
+    unsigned long numGridPoints = 1;
+    for(auto &values : grid)
+    {
+        numGridPoints *= values.size();
+    }
+
+    if(samples.getNumSamples() != numGridPoints)
+    {
+        return false;
+    }
+
+    factors.clear();
+    for(unsigned int dim = 0; dim < numVariables; dim++)
+    {
+        BSplineBasis1D basis1D = basis.getSingleBasis(dim);
+
+        SparseMatrix factor(grid.at(dim).size(), basis1D.numBasisFunctions());
+        factor.reserve(DenseVector::Constant(basis1D.numBasisFunctions(), basis1D.getBasisDegree() + 1));
+
+        int i = 0;
+        for(auto value : grid.at(dim))
+        {
+            SparseVector basisValues = basis1D.evaluate(value);
+            for(SparseVector::InnerIterator it(basisValues); it; ++it)
+            {
+                factor.insert(i, it.index()) = it.value();
+            }
+            i++;
+        }
+
+        factor.makeCompressed();
+        factors.push_back(factor);
+    }
+
+    return true;
+}
+
+void BSplineFitter::computeBasisFunctionMatrix(const BSplineBasis &basis, const DataTable &samples, SparseMatrix &A)
+{
+    unsigned int numVariables = samples.getNumVariables();
+    unsigned int numSamples = samples.getNumSamples();
+
+    int nnzPrCol = basis.supportedPrInterval();
+
+    A.resize(numSamples, basis.numBasisFunctions());
+    A.reserve(DenseVector::Constant(numSamples, nnzPrCol)); // TODO: should reserve nnz per row!
+
+    int i = 0;
+    for(auto it = samples.cbegin(); it != samples.cend(); ++it, ++i)
+    {
+        DenseVector xi(numVariables);
+        std::vector<double> xv = it->getX();
+        for(unsigned int j = 0; j < numVariables; ++j)
+        {
+            xi(j) = xv.at(j);
+        }
+
+        SparseVector basisValues = basis.eval(xi);
+
+        for (SparseVector::InnerIterator it2(basisValues); it2; ++it2)
+        {
+            A.insert(i,it2.index()) = it2.value();
+        }
+    }
+
+    A.makeCompressed();
+}
+
+DenseMatrix BSplineFitter::solve(const DenseMatrix &y) const
+{
+    if(y.rows() != numSamples)
+    {
+        throw Exception("BSplineFitter::solve: Number of sample values does not match the number of samples.");
+    }
+
+    DenseMatrix c;
+
+    if(kroneckerSolver)
+    {
+        if(!kroneckerSolver->solve(y, c))
+        {
+            throw Exception("BSplineFitter::solve: Failed to solve for B-spline coefficients.");
+        }
+        return c;
+    }
+
+    if(penalizedKroneckerSolver)
+    {
+        // Right-hand side B'*y, computed mode by mode
+        DenseMatrix rhs = multiplyUnivariateCollocation(y, true);
+
+        if(!penalizedKroneckerSolver->solve(rhs, c))
+        {
+            throw Exception("BSplineFitter::solve: Failed to solve for B-spline coefficients.");
+        }
+        return c;
+    }
+
+    DenseMatrix rhs;
+    if(penalized)
+    {
+        rhs = collocation.transpose()*y;
+    }
+    else
+    {
+        rhs = y;
+    }
+
+    bool success = true;
+
+    switch(solverType)
+    {
+    case LinearSolverType::SPARSE_LDLT:
+        c = sparseLDLT->solve(rhs);
+        break;
+    case LinearSolverType::SPARSE_CG:
+        c = sparseCG->solve(rhs);
+        // CG may stop at its iteration limit on a large system. The equations are then solved by a factorization.
+        if(sparseCG->info() != Eigen::Success || !validSolution(rhs, c))
+        {
+            success = solveFactorized(rhs, c);
+        }
+        break;
+    case LinearSolverType::SPARSE_LU:
+        c = sparseLU->solve(rhs);
+        break;
+    case LinearSolverType::SPARSE_QR:
+        c = sparseQR->solve(rhs);
+        break;
+    default:
+        c = denseQR->solve(rhs);
+    }
+
+    if(!success || !validSolution(rhs, c))
+    {
+        throw Exception("BSplineFitter::solve: Failed to solve for B-spline coefficients.");
+    }
+
+    return c;
+}
+
+void BSplineFitter::setTolerance(double tolerance)
+{
+    tol = tolerance;
+
+    if(sparseCG)
+    {
+        sparseCG->setTolerance(tolerance);
+    }
+}
+
+bool BSplineFitter::setLambda(double lambda)
+{
+    if(!penalizedKroneckerSolver)
+    {
+        return false;
+    }
+
+    this->lambda = lambda;
+    penalizedKroneckerSolver->setLambda(lambda);
+    return true;
+}
+
+bool BSplineFitter::validSolution(const DenseMatrix &rhs, const DenseMatrix &c) const
+{
+    return !checkResidual || (lhs*c - rhs).norm() <= tol*rhs.norm();
+}
+
+// Sparse LDLT, or sparse LU if the left-hand side is not positive definite after all
+bool BSplineFitter::solveFactorized(const DenseMatrix &rhs, DenseMatrix &c) const
+{
+    Eigen::SimplicialLDLT<SparseMatrix> ldlt(lhs);
+    if(ldlt.info() == Eigen::Success)
+    {
+        c = ldlt.solve(rhs);
+        if(ldlt.info() == Eigen::Success && validSolution(rhs, c))
+        {
+            return true;
+        }
+    }
+
+    Eigen::SparseLU<SparseMatrix> lu;
+    lu.analyzePattern(lhs);
+    lu.factorize(lhs);
+    if(lu.info() != Eigen::Success)
+    {
+        return false;
+    }
+
+    c = lu.solve(rhs);
+    return lu.info() == Eigen::Success;
+}
+
+DenseMatrix BSplineFitter::fittedValues(const DenseMatrix &coefficients) const
+{
+    if(coefficients.rows() != basis.numBasisFunctions())
+    {
+        throw Exception("BSplineFitter::fittedValues: Number of coefficients does not match the number of basis functions.");
+    }
+
+    if(kroneckerSolver)
+    {
+        return kroneckerSolver->multiply(coefficients);
+    }
+
+    if(penalizedKroneckerSolver)
+    {
+        return multiplyUnivariateCollocation(coefficients, false);
+    }
+
+    // The left-hand side is B itself for interpolation
+    return penalized ? DenseMatrix(collocation*coefficients) : DenseMatrix(lhs*coefficients);
+}
+
+DenseMatrix BSplineFitter::multiplyUnivariateCollocation(const DenseMatrix &x, bool transpose) const
+{
+    std::vector<unsigned int> sizes;
+    for(auto &Bd : univariateCollocation)
+    {
+        sizes.push_back(transpose ? Bd.rows() : Bd.cols());
+    }
+
+    DenseMatrix y = x;
+    for(unsigned int mode = 0; mode < univariateCollocation.size(); mode++)
+    {
+        const SparseMatrix &Bd = univariateCollocation.at(mode);
+        if(transpose)
+        {
+            y = modeProduct(y, sizes, mode, [&Bd](const DenseMatrix &fibers) -> DenseMatrix { return Bd.transpose()*fibers; });
+        }
+        else
+        {
+            y = modeProduct(y, sizes, mode, [&Bd](const DenseMatrix &fibers) -> DenseMatrix { return Bd*fibers; });
+        }
+    }
+
+    return y;
+}
+
+/*
+ * Selects the smoothing parameter lambda of a P-spline by minimizing
+ *   GCV(lambda) = n*RSS/(n - tr(H))^2, where H = B*(B'*B + lambda*S)^(-1)*B' and S = D'*D, or
+ *   REML(lambda) = (n - m0)*log(RSS + lambda*c'*S*c) + log|B'*B + lambda*S| - r*log(lambda),
+ * where RSS is the residual sum of squares of the fit, and r and m0 are the rank and the nullity of S.
+ * The criterion is evaluated on a path of lambdas from 1e-6 to 1e6 (two per decade), and the minimum
+ * is refined by golden section search in log(lambda) between the neighbours of the best point on the path.
+ *
+ * With up to 500 coefficients (2000 for REML, which requires it), B'*B and S are decomposed once as V'*B'*B*V = I and V'*S*V = diag(mu)
+ * (generalized eigenvectors). Then c = V*(I + lambda*diag(mu))^(-1)*w with w = V'*B'*y, and both
+ * criteria are evaluated exactly in O(N) operations per lambda, for N coefficients. The decomposition
+ * takes O(N^3) operations, so larger problems are fitted for each lambda, and tr(H) is estimated with Hutchinson's method, tr(H) ~ mean of z'*H*z over random vectors z with
+ * entries +-1. The random vectors are fitted together with y, and they are fixed, so that the estimate
+ * is a smooth function of lambda. With one sample per grid point, the univariate eigendecompositions of the
+ * fit without B'*B (see factorizeGLAM) are computed once, and only the CG solve is repeated for each lambda.
+ */
+double BSplineFitter::selectLambda(const DataTable &samples, const BSplineBasis &basis, SmoothingCriterion criterion)
+{
+    const unsigned int maxExactSize = (criterion == SmoothingCriterion::REML) ? 2000 : 500;
+    const unsigned int numProbes = 16;
+
+    if(!samples.isGridComplete())
+    {
+        throw Exception("BSplineFitter::selectLambda: Cannot fit B-spline to irregular (incomplete) grid.");
+    }
+
+    std::vector<double> yv = samples.getVectorY();
+    DenseVector y = Eigen::Map<DenseVector>(yv.data(), yv.size());
+    double n = y.size();
+
+    std::function<double(double)> score;
+
+    // Data for the exact evaluation
+    DenseVector mu, w;
+    double orthogonalResidual = 0;
+    double rank = 0;
+
+    // Data for the estimated evaluation
+    DenseMatrix Y;
+    std::shared_ptr<BSplineFitter> fitter;
+
+    if(basis.numBasisFunctions() <= maxExactSize)
+    {
+        SparseMatrix B, D;
+        computeBasisFunctionMatrix(basis, samples, B);
+        PSpline::getSecondOrderFiniteDifferenceMatrix(basis, D);
+
+        DenseMatrix BtB = B.transpose()*B;
+        DenseMatrix S = D.transpose()*D;
+
+        Eigen::GeneralizedSelfAdjointEigenSolver<DenseMatrix> eigenSolver(S, BtB);
+        if(eigenSolver.info() != Eigen::Success)
+        {
+            throw Exception("BSplineFitter::selectLambda: Too few samples to determine the coefficients (B'*B is singular).");
+        }
+
+        // With Q = B*V (orthonormal columns), y = Q*w + r, where r is orthogonal to the range of Q
+        mu = eigenSolver.eigenvalues().cwiseMax(0);
+        w = eigenSolver.eigenvectors().transpose()*(B.transpose()*y);
+        orthogonalResidual = std::max(0.0, y.squaredNorm() - w.squaredNorm());
+
+        for(unsigned int i = 0; i < mu.size(); i++)
+        {
+            if(mu(i) > 1e-10*mu.maxCoeff())
+            {
+                rank++;
+            }
+        }
+
+        score = [&](double lambda) -> double
+        {
+            double rss = orthogonalResidual;
+            double penalty = 0;
+            double residualDegrees = 0; // n - tr(H)
+            double logDeterminant = 0;
+
+            for(unsigned int i = 0; i < mu.size(); i++)
+            {
+                double shrinkage = lambda*mu(i)/(1 + lambda*mu(i));
+                rss += shrinkage*shrinkage*w(i)*w(i);
+                penalty += mu(i)*w(i)*w(i)/((1 + lambda*mu(i))*(1 + lambda*mu(i)));
+                residualDegrees += shrinkage;
+                logDeterminant += std::log(1 + lambda*mu(i));
+            }
+            residualDegrees += n - mu.size();
+
+            if(criterion == SmoothingCriterion::REML)
+            {
+                return (n - (mu.size() - rank))*std::log(rss + lambda*penalty) + logDeterminant - rank*std::log(lambda);
+            }
+
+            return n*rss/(residualDegrees*residualDegrees);
+        };
+    }
+    else
+    {
+        if(criterion == SmoothingCriterion::REML)
+        {
+            throw Exception("BSplineFitter::selectLambda: REML is only supported with up to 2000 coefficients.");
+        }
+
+        // Sample values followed by the random vectors
+        std::mt19937 generator(0);
+        std::bernoulli_distribution coin(0.5);
+
+        Y.resize(y.size(), 1 + numProbes);
+        Y.col(0) = y;
+        for(unsigned int k = 1; k <= numProbes; k++)
+        {
+            for(unsigned int i = 0; i < y.size(); i++)
+            {
+                Y(i,k) = coin(generator) ? 1 : -1;
+            }
+        }
+
+        // On grids with one sample per grid point, the fitter is set up once and only the CG solve is repeated for each lambda
+        fitter = std::make_shared<BSplineFitter>(samples, basis, 1.0);
+
+        score = [&](double lambda) -> double
+        {
+            if(!fitter->setLambda(lambda))
+            {
+                fitter = std::make_shared<BSplineFitter>(samples, basis, lambda);
+            }
+            DenseMatrix fitted = fitter->fittedValues(fitter->solve(Y));
+
+            double rss = (Y.col(0) - fitted.col(0)).squaredNorm();
+
+            double trace = 0;
+            for(unsigned int k = 1; k <= numProbes; k++)
+            {
+                trace += Y.col(k).dot(fitted.col(k));
+            }
+            trace /= numProbes;
+
+            return n*rss/((n - trace)*(n - trace));
+        };
+    }
+
+    // Lambda path
+    std::vector<double> logLambdas;
+    std::vector<double> scores;
+    for(int i = -12; i <= 12; i++)
+    {
+        logLambdas.push_back(i/2.0*std::log(10.0));
+        scores.push_back(score(std::exp(logLambdas.back())));
+    }
+
+    unsigned int best = std::min_element(scores.begin(), scores.end()) - scores.begin();
+
+    // Golden section search in the bracket around the best point on the path
+    double a = logLambdas.at(best > 0 ? best - 1 : best);
+    double b = logLambdas.at(best + 1 < logLambdas.size() ? best + 1 : best);
+    double ratio = (std::sqrt(5.0) - 1)/2;
+
+    double c = b - ratio*(b - a);
+    double d = a + ratio*(b - a);
+    double fc = score(std::exp(c));
+    double fd = score(std::exp(d));
+
+    for(unsigned int iteration = 0; iteration < 10; iteration++)
+    {
+        if(fc < fd)
+        {
+            b = d;
+            d = c;
+            fd = fc;
+            c = b - ratio*(b - a);
+            fc = score(std::exp(c));
+        }
+        else
+        {
+            a = c;
+            c = d;
+            fc = fd;
+            d = a + ratio*(b - a);
+            fd = score(std::exp(d));
+        }
+    }
+
+    double lambda = std::exp(fc < fd ? c : d);
+
+    // Keep the path point if the refinement did not improve on it
+    if(scores.at(best) < std::min(fc, fd))
+    {
+        lambda = std::exp(logLambdas.at(best));
+    }
+
+#ifndef NDEBUG
+    std::cout << "Selected smoothing parameter lambda = " << lambda << std::endl;
+#endif // NDEBUG
+
+    return lambda;
+}
+
+BSpline BSplineFitter::refit(const DenseMatrix &y) const
+{
+    DenseMatrix coefficients = solve(y).transpose();
+
+    std::vector<unsigned int> basisDegrees;
+    for(unsigned int dim = 0; dim < grid.size(); dim++)
+    {
+        basisDegrees.push_back(basis.getBasisDegree(dim));
+    }
+
+    return BSpline(coefficients, basis.getKnotVectors(), basisDegrees);
+}
+
+BSpline BSplineFitter::refit(const DataTable &samples) const
+{
+    if(samples.getNumSamples() != numSamples || samples.getGrid() != grid)
+    {
+        throw Exception("BSplineFitter::refit: The samples are not on the grid of the fitter.");
+    }
+
+    std::vector<double> y = samples.getVectorY();
+
+    return refit(DenseMatrix(Eigen::Map<DenseVector>(y.data(), y.size())));
+}
+
+} // namespace MultivariateSplines
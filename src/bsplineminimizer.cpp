@@ -0,0 +1,255 @@
+/*
+ * This file is part of the Multivariate Splines library.
+ * Copyright (C) 2012 Bjarne Grimstad (bjarne.grimstad@gmail.com)
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+
+#include "include/bsplineminimizer.h"
+#include "include/threadpool.h"
+
+#include <chrono>
+#include <limits>
+#include <queue>
+
+namespace MultivariateSplines
+{
+
+BSplineMinimizer::BSplineMinimizer(const BSpline &bspline)
+    : root(bspline),
+      tol(1e-6),
+      maxNodes(1000000),
+      batchSize(64),
+      minWidth(1e-9),
+      minimum(std::numeric_limits<double>::infinity()),
+      lowerBound(-std::numeric_limits<double>::infinity()),
+      numNodes(0),
+      numRounds(0),
+      elapsedTime(0)
+{
+    if(bspline.getNumOutputs() != 1)
+    {
+        throw Exception("BSplineMinimizer::BSplineMinimizer: B-spline must have one output.");
+    }
+
+    std::vector<double> lb = bspline.getDomainLowerBound();
+    std::vector<double> ub = bspline.getDomainUpperBound();
+    for(unsigned int dim = 0; dim < lb.size(); dim++)
+        domainWidth.push_back(ub.at(dim) - lb.at(dim));
+}
+
+bool BSplineMinimizer::minimize()
+{
+    auto start = std::chrono::steady_clock::now();
+
+    const double infinity = std::numeric_limits<double>::infinity();
+
+    minimizer = DenseVector();
+    minimum = infinity;
+    numNodes = 0;
+    numRounds = 0;
+
+    // Open nodes, best-first (smallest lower bound, then oldest)
+    auto worse = [](const Node &a, const Node &b)
+    {
+        return a.lowerBound > b.lowerBound || (a.lowerBound == b.lowerBound && a.id > b.id);
+    };
+    std::priority_queue<Node, std::vector<Node>, decltype(worse)> queue(worse);
+
+    unsigned long nextId = 0;
+    queue.push(Node{root, -infinity, nextId++});
+
+    double closedBound = infinity; // Smallest lower bound of the nodes that are pruned or too narrow to split
+
+    while(!queue.empty() && numNodes < maxNodes)
+    {
+        // The nodes with the smallest lower bounds that may improve the incumbent
+        std::vector<Node> batch;
+        while(!queue.empty() && batch.size() < batchSize && numNodes + batch.size() < maxNodes
+              && queue.top().lowerBound < minimum - tol)
+        {
+            batch.push_back(queue.top());
+            queue.pop();
+        }
+
+        if(batch.empty())
+            break;
+
+        std::vector<NodeResult> results(batch.size());
+
+        ThreadPool::getDefault().parallelFor(batch.size(), 1, [&](unsigned int begin, unsigned int end)
+        {
+            for(unsigned int i = begin; i < end; i++)
+                processNode(batch.at(i), results.at(i));
+        });
+
+        numNodes += batch.size();
+        numRounds++;
+
+        // Merge the results in the order of the batch
+        for(auto &result : results)
+        {
+            if(result.value < minimum)
+            {
+                minimum = result.value;
+                minimizer = result.x;
+            }
+        }
+
+        for(unsigned int i = 0; i < batch.size(); i++)
+        {
+            const NodeResult &result = results.at(i);
+
+            if(result.lowerBound >= minimum - tol || !result.split)
+            {
+                closedBound = std::min(closedBound, result.lowerBound);
+                continue;
+            }
+
+            const BSplineView &view = batch.at(i).view;
+            std::vector<double> lb = view.getDomainLowerBound();
+            std::vector<double> ub = view.getDomainUpperBound();
+
+            std::vector<double> ubLeft = ub;
+            ubLeft.at(result.splitDim) = result.splitPoint;
+            std::vector<double> lbRight = lb;
+            lbRight.at(result.splitDim) = result.splitPoint;
+
+            queue.push(Node{view.subdomain(lb, ubLeft), result.lowerBound, nextId++});
+            queue.push(Node{view.subdomain(lbRight, ub), result.lowerBound, nextId++});
+        }
+    }
+
+    // The global minimum is bounded by the incumbent, and by the lower bounds of the open and closed nodes
+    lowerBound = std::min(minimum, closedBound);
+    if(!queue.empty())
+        lowerBound = std::min(lowerBound, queue.top().lowerBound);
+
+    elapsedTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    return minimum - lowerBound <= tol;
+}
+
+void BSplineMinimizer::processNode(const Node &node, NodeResult &result) const
+{
+    const BSplineView &view = node.view;
+    std::vector<double> lb = view.getDomainLowerBound();
+    std::vector<double> ub = view.getDomainUpperBound();
+    unsigned int numVariables = lb.size();
+
+    // Lower bound from the control points of the B-spline reduced to the box
+    DenseVector lower, upper;
+    view.bounds(lower, upper, true);
+    result.lowerBound = std::max(lower(0), node.lowerBound);
+
+    // Local minimization from the control point with the smallest coefficient, moved into the box
+    DenseMatrix controlPoints = view.getControlPoints();
+    unsigned int best;
+    controlPoints.row(numVariables).minCoeff(&best);
+
+    result.x = controlPoints.col(best).head(numVariables);
+    for(unsigned int dim = 0; dim < numVariables; dim++)
+        result.x(dim) = std::min(std::max(result.x(dim), lb.at(dim)), ub.at(dim));
+
+    result.value = localMinimize(view, result.x);
+
+    // Split along the widest side, relative to the domain
+    result.splitDim = 0;
+    double widest = 0;
+    for(unsigned int dim = 0; dim < numVariables; dim++)
+    {
+        double width = (ub.at(dim) - lb.at(dim))/domainWidth.at(dim);
+        if(width > widest)
+        {
+            widest = width;
+            result.splitDim = dim;
+        }
+    }
+
+    result.split = (widest > minWidth);
+    result.splitPoint = (lb.at(result.splitDim) + ub.at(result.splitDim))/2;
+}
+
+/*
+ * Newton steps are taken in the variables that are not held at a bound by the gradient. If the Hessian of
+ * these variables is not positive definite, the steepest descent direction is used instead. The step is
+ * projected onto the box and halved until the value decreases.
+ */
+double BSplineMinimizer::localMinimize(const BSplineView &view, DenseVector &x) const
+{
+    std::vector<double> lb = view.getDomainLowerBound();
+    std::vector<double> ub = view.getDomainUpperBound();
+    unsigned int numVariables = lb.size();
+
+    double value = view.eval(x);
+
+    for(unsigned int iteration = 0; iteration < 20; iteration++)
+    {
+        DenseVector gradient = view.evalJacobian(x).transpose();
+        DenseMatrix hessian = view.evalHessian(x);
+
+        std::vector<unsigned int> free;
+        for(unsigned int dim = 0; dim < numVariables; dim++)
+        {
+            bool atLower = (x(dim) <= lb.at(dim) && gradient(dim) > 0);
+            bool atUpper = (x(dim) >= ub.at(dim) && gradient(dim) < 0);
+            if(!atLower && !atUpper)
+                free.push_back(dim);
+        }
+
+        if(free.empty())
+            break;
+
+        DenseVector freeGradient(free.size());
+        DenseMatrix freeHessian(free.size(), free.size());
+        for(unsigned int i = 0; i < free.size(); i++)
+        {
+            freeGradient(i) = gradient(free.at(i));
+            for(unsigned int j = 0; j < free.size(); j++)
+                freeHessian(i,j) = hessian(free.at(i), free.at(j));
+        }
+
+        DenseVector freeStep = -freeGradient;
+        Eigen::LDLT<DenseMatrix> ldlt(freeHessian);
+        if(ldlt.info() == Eigen::Success && ldlt.vectorD().minCoeff() > 0)
+            freeStep = ldlt.solve(-freeGradient);
+
+        DenseVector step = DenseVector::Zero(numVariables);
+        for(unsigned int i = 0; i < free.size(); i++)
+            step(free.at(i)) = freeStep(i);
+
+        // Backtracking along the projected step
+        bool decreased = false;
+        DenseVector candidate(numVariables);
+        double candidateValue = value;
+        for(double alpha = 1; alpha > 1e-10; alpha /= 2)
+        {
+            for(unsigned int dim = 0; dim < numVariables; dim++)
+                candidate(dim) = std::min(std::max(x(dim) + alpha*step(dim), lb.at(dim)), ub.at(dim));
+
+            candidateValue = view.eval(candidate);
+            if(candidateValue < value)
+            {
+                decreased = true;
+                break;
+            }
+        }
+
+        if(!decreased)
+            break;
+
+        double change = (candidate - x).cwiseAbs().maxCoeff();
+        x = candidate;
+        value = candidateValue;
+
+        if(change < 1e-12)
+            break;
+    }
+
+    return value;
+}
+
+} // namespace MultivariateSplines
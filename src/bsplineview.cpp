@@ -0,0 +1,178 @@
+/*
+ * This file is part of the Multivariate Splines library.
+ * Copyright (C) 2012 Bjarne Grimstad (bjarne.grimstad@gmail.com)
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+
+#include "include/bsplineview.h"
+
+namespace MultivariateSplines
+{
+
+BSplineView::BSplineView(const BSpline &bspline)
+    : BSplineView(std::shared_ptr<BSpline>(new BSpline(bspline)))
+{
+}
+
+BSplineView::BSplineView(std::shared_ptr<BSpline> bspline)
+    : BSplineView(bspline, bspline->getDomainLowerBound(), bspline->getDomainUpperBound())
+{
+}
+
+BSplineView::BSplineView(std::shared_ptr<BSpline> bspline, const std::vector<double> &lb, const std::vector<double> &ub)
+    : bspline(bspline),
+      lb(lb),
+      ub(ub)
+{
+    bspline->basis.indexSupportedBasisFunctions(lb, ub, first, count);
+}
+
+BSplineView BSplineView::subdomain(const std::vector<double> &lb, const std::vector<double> &ub) const
+{
+    unsigned int numVariables = getNumVariables();
+
+    if(lb.size() != numVariables || ub.size() != numVariables)
+    {
+        throw Exception("BSplineView::subdomain: Bounds have wrong dimension.");
+    }
+
+    for(unsigned int dim = 0; dim < numVariables; dim++)
+    {
+        if(!(this->lb.at(dim) <= lb.at(dim) && lb.at(dim) < ub.at(dim) && ub.at(dim) <= this->ub.at(dim)))
+        {
+            throw Exception("BSplineView::subdomain: Bounds must define a non-empty box inside the domain of the view.");
+        }
+    }
+
+    return BSplineView(bspline, lb, ub);
+}
+
+double BSplineView::eval(DenseVector x) const
+{
+    if(!insideDomain(x))
+    {
+        throw Exception("BSplineView::eval: Evaluation at point outside domain.");
+    }
+
+    return bspline->eval(x);
+}
+
+DenseVector BSplineView::evalVector(DenseVector x) const
+{
+    if(!insideDomain(x))
+    {
+        throw Exception("BSplineView::evalVector: Evaluation at point outside domain.");
+    }
+
+    return bspline->evalVector(x);
+}
+
+DenseMatrix BSplineView::evalJacobian(DenseVector x) const
+{
+    if(!insideDomain(x))
+    {
+        throw Exception("BSplineView::evalJacobian: Evaluation at point outside domain.");
+    }
+
+    return bspline->evalJacobian(x);
+}
+
+DenseMatrix BSplineView::evalHessian(DenseVector x) const
+{
+    if(!insideDomain(x))
+    {
+        throw Exception("BSplineView::evalHessian: Evaluation at point outside domain.");
+    }
+
+    return bspline->evalHessian(x);
+}
+
+unsigned int BSplineView::getNumControlPoints() const
+{
+    unsigned int numControlPoints = 1;
+    for(auto n : count)
+        numControlPoints *= n;
+    return numControlPoints;
+}
+
+DenseMatrix BSplineView::getControlPoints() const
+{
+    std::vector<unsigned int> sizes = bspline->numBasisFunctionsPerDimension();
+
+    DenseMatrix knotaverages = BSpline::selectSubTensor(bspline->knotaverages, sizes, first, count);
+    DenseMatrix coefficients = BSpline::selectSubTensor(bspline->coefficients, sizes, first, count);
+
+    DenseMatrix controlPoints(knotaverages.rows() + coefficients.rows(), coefficients.cols());
+    controlPoints << knotaverages, coefficients;
+
+    return controlPoints;
+}
+
+void BSplineView::bounds(DenseVector &lower, DenseVector &upper, bool tighten) const
+{
+    bspline->bounds(lb, ub, lower, upper, tighten);
+}
+
+BSpline BSplineView::toBSpline() const
+{
+    BSpline reduced = *bspline;
+    reduced.reduceDomain(lb, ub);
+    return reduced;
+}
+
+bool BSplineView::insertKnots(const std::vector<double> &tau, unsigned int dim)
+{
+    std::shared_ptr<BSpline> own = ownBSpline();
+
+    if(!own->insertKnots(tau, dim))
+        return false;
+
+    bspline = own;
+    bspline->basis.indexSupportedBasisFunctions(lb, ub, first, count);
+
+    return true;
+}
+
+bool BSplineView::insertKnots(const std::vector< std::vector<double> > &tau)
+{
+    std::shared_ptr<BSpline> own = ownBSpline();
+
+    if(!own->insertKnots(tau))
+        return false;
+
+    bspline = own;
+    bspline->basis.indexSupportedBasisFunctions(lb, ub, first, count);
+
+    return true;
+}
+
+bool BSplineView::insideDomain(const DenseVector &x) const
+{
+    if((size_t)x.size() != lb.size())
+        return false;
+
+    for(unsigned int dim = 0; dim < lb.size(); dim++)
+    {
+        if(!(lb.at(dim) <= x(dim) && x(dim) <= ub.at(dim)))
+            return false;
+    }
+
+    return true;
+}
+
+std::shared_ptr<BSpline> BSplineView::ownBSpline() const
+{
+    if(!isShared() && lb == bspline->getDomainLowerBound() && ub == bspline->getDomainUpperBound())
+        return bspline;
+
+    std::shared_ptr<BSpline> own(new BSpline(*bspline));
+    own->reduceDomain(lb, ub);
+
+    return own;
+}
+
+} // namespace MultivariateSplines
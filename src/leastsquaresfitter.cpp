@@ -0,0 +1,772 @@
+/*
+ * This file is part of the Multivariate Splines library.
+ * Copyright (C) 2012 Bjarne Grimstad (bjarne.grimstad@gmail.com)
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+
+#include "include/leastsquaresfitter.h"
+#include "include/pspline.h"
+#include "include/threadpool.h"
+
+#include <Eigen/SparseCholesky>
+#include <functional>
+#include <algorithm>
+#include <iostream>
+
+namespace MultivariateSplines
+{
+
+/*
+ * Calls body(block, begin, end) in parallel for numBlocks consecutive blocks [begin, end) of the samples.
+ * The blocks depend only on numSamples and numBlocks, so that sums over the blocks are reproducible.
+ */
+static void parallelBlocks(unsigned int numSamples, unsigned int numBlocks, const std::function<void(unsigned int, unsigned int, unsigned int)> &body)
+{
+    ThreadPool::getDefault().parallelFor(numBlocks, 1, [&](unsigned int begin, unsigned int end)
+    {
+        for(unsigned int block = begin; block < end; block++)
+        {
+            body(block, (unsigned long)numSamples*block/numBlocks, (unsigned long)numSamples*(block + 1)/numBlocks);
+        }
+    });
+}
+
+LeastSquaresFitter::LeastSquaresFitter(const BSplineBasis &basis)
+    : basis(basis),
+      lambda(0),
+      solver(LeastSquaresSolver::CHOLESKY),
+      tol(1e-10),
+      maxIterations(10000),
+      forgettingFactor(1)
+{
+    init();
+    clearAccumulated();
+}
+
+LeastSquaresFitter::LeastSquaresFitter(const BSplineBasis &basis, double lambda)
+    : LeastSquaresFitter(basis)
+{
+    SparseMatrix D;
+    PSpline::getSecondOrderFiniteDifferenceMatrix(basis, D);
+    setPenalty(D, lambda);
+}
+
+LeastSquaresFitter::LeastSquaresFitter(const BSplineBasis &basis, const SparseMatrix &penalty, double lambda)
+    : LeastSquaresFitter(basis)
+{
+    if(penalty.cols() != numCoefficients)
+    {
+        throw Exception("LeastSquaresFitter::LeastSquaresFitter: Number of columns of the penalty matrix does not match the number of basis functions.");
+    }
+
+    setPenalty(penalty, lambda);
+}
+
+void LeastSquaresFitter::setPenalty(const SparseMatrix &penalty, double lambda)
+{
+    this->lambda = lambda;
+    this->penalty = penalty;
+
+    if(lambda > 0)
+    {
+        penaltyGram = lambda*SparseMatrix(penalty.transpose())*penalty;
+    }
+}
+
+void LeastSquaresFitter::init()
+{
+    numVariables = basis.getKnotVectors().size();
+    numCoefficients = basis.numBasisFunctions();
+
+    std::vector<int> degrees;
+    for(unsigned int dim = 0; dim < numVariables; dim++)
+    {
+        degrees.push_back(basis.getBasisDegree(dim));
+    }
+
+    stride.assign(numVariables, 1);
+    std::vector<int> offsetStride(numVariables, 1);
+    for(int dim = numVariables - 1; dim > 0; dim--)
+    {
+        stride.at(dim-1) = stride.at(dim)*basis.numBasisFunctions(dim);
+        offsetStride.at(dim-1) = offsetStride.at(dim)*(2*degrees.at(dim) + 1);
+    }
+
+    numSupported = 1;
+    numOffsets = 1;
+    for(auto degree : degrees)
+    {
+        numSupported *= degree + 1;
+        numOffsets *= 2*degree + 1;
+    }
+
+    // The nonnegative offsets are those from the center (zero offset) on
+    unsigned int center = numOffsets/2;
+    numSlots = numOffsets - center;
+
+    offsets.resize(numOffsets*numVariables);
+    for(unsigned int o = 0; o < numOffsets; o++)
+    {
+        unsigned int rest = o;
+        for(int dim = numVariables - 1; dim >= 0; dim--)
+        {
+            offsets.at(o*numVariables + dim) = rest%(2*degrees.at(dim) + 1) - degrees.at(dim);
+            rest /= 2*degrees.at(dim) + 1;
+        }
+    }
+
+    // Tensor indices of the supported basis functions relative to the first (the last dimension varies fastest)
+    std::vector< std::vector<int> > local(numSupported, std::vector<int>(numVariables));
+    localIndex.assign(numSupported, 0);
+    for(unsigned int a = 0; a < numSupported; a++)
+    {
+        unsigned int rest = a;
+        for(int dim = numVariables - 1; dim >= 0; dim--)
+        {
+            local.at(a).at(dim) = rest%(degrees.at(dim) + 1);
+            rest /= degrees.at(dim) + 1;
+            localIndex.at(a) += local.at(a).at(dim)*stride.at(dim);
+        }
+    }
+
+    // Pairs (a,b) with b >= a have a nonnegative offset
+    pairStart.clear();
+    pairOther.clear();
+    pairSlot.clear();
+    for(unsigned int a = 0; a < numSupported; a++)
+    {
+        pairStart.push_back(pairOther.size());
+        for(unsigned int b = a; b < numSupported; b++)
+        {
+            unsigned int o = 0;
+            for(unsigned int dim = 0; dim < numVariables; dim++)
+            {
+                o += (local.at(b).at(dim) - local.at(a).at(dim) + degrees.at(dim))*offsetStride.at(dim);
+            }
+            pairOther.push_back(b);
+            pairSlot.push_back(o - center);
+        }
+    }
+    pairStart.push_back(pairOther.size());
+}
+
+BSpline LeastSquaresFitter::fit(const DenseMatrix &X, const DenseMatrix &y) const
+{
+    DenseMatrix coefficients = solve(X, y).transpose();
+
+    std::vector<unsigned int> basisDegrees;
+    for(unsigned int dim = 0; dim < numVariables; dim++)
+    {
+        basisDegrees.push_back(basis.getBasisDegree(dim));
+    }
+
+    return BSpline(coefficients, basis.getKnotVectors(), basisDegrees);
+}
+
+BSpline LeastSquaresFitter::fit(const DataTable &samples) const
+{
+    DenseMatrix X(samples.getNumSamples(), samples.getNumVariables());
+    DenseMatrix y(samples.getNumSamples(), 1);
+
+    unsigned int i = 0;
+    for(auto it = samples.cbegin(); it != samples.cend(); ++it, ++i)
+    {
+        std::vector<double> x = it->getX();
+        for(unsigned int dim = 0; dim < x.size(); dim++)
+        {
+            X(i, dim) = x.at(dim);
+        }
+        y(i, 0) = it->getY();
+    }
+
+    return fit(X, y);
+}
+
+/*
+ * Solves the normal equations (B'*B + lambda*D'*D)*c = B'*y with a sparse LDLT factorization, or the least
+ * squares problem min |[B; sqrt(lambda)*D]*c - [y; 0]| with LSQR.
+ */
+DenseMatrix LeastSquaresFitter::solve(const DenseMatrix &X, const DenseMatrix &y) const
+{
+    checkSamples(X, y);
+
+    if(solver == LeastSquaresSolver::LSQR)
+    {
+        return solveLSQR(X, y);
+    }
+
+    std::vector<double> gram((size_t)numCoefficients*numSlots, 0);
+    DenseMatrix rhs = DenseMatrix::Zero(numCoefficients, y.cols());
+    accumulateNormalEquations(X, y, DenseVector(), gram, rhs);
+
+    Eigen::SimplicialLDLT<SparseMatrix> ldlt;
+    return solveNormalEquations(gram, rhs, 1, ldlt, true);
+}
+
+/*
+ * Solves (scale*B'*B + lambda*D'*D)*c = scale*B'*y, with B'*B in band storage. The symbolic factorization
+ * of ldlt is computed if analyzePattern is set, and reused otherwise (the sparsity pattern is always the same).
+ */
+DenseMatrix LeastSquaresFitter::solveNormalEquations(const std::vector<double> &gram, const DenseMatrix &rhs, double scale, Eigen::SimplicialLDLT<SparseMatrix> &ldlt, bool analyzePattern) const
+{
+    SparseMatrix lhs = scale*assembleGramMatrix(gram);
+
+    if(penaltyGram.rows() > 0)
+    {
+        lhs += penaltyGram;
+    }
+
+    if(analyzePattern)
+    {
+        ldlt.analyzePattern(lhs);
+    }
+    ldlt.factorize(lhs);
+
+    // Basis functions without samples in their support give (numerically) zero pivots
+    if(ldlt.info() != Eigen::Success || !(ldlt.vectorD().minCoeff() > 1e-12*ldlt.vectorD().maxCoeff()))
+    {
+        throw Exception("LeastSquaresFitter::solveNormalEquations: The normal equations are singular (some basis functions have no samples in their support). Use fewer knots or a penalty.");
+    }
+
+    return ldlt.solve(scale*rhs);
+}
+
+void LeastSquaresFitter::computeNormalEquations(const DenseMatrix &X, const DenseMatrix &y, SparseMatrix &BtB, DenseMatrix &Bty) const
+{
+    checkSamples(X, y);
+
+    std::vector<double> gram((size_t)numCoefficients*numSlots, 0);
+    Bty.setZero(numCoefficients, y.cols());
+    accumulateNormalEquations(X, y, DenseVector(), gram, Bty);
+    BtB = assembleGramMatrix(gram);
+}
+
+/*
+ * Adds samples to the accumulated sums. With forgetting factor f, sample j of the k new samples gets the weight
+ * weights(j)*f^(k-1-j), and the sums of the earlier samples are multiplied by f^k. The multiplication is recorded
+ * in accumulatedScale, and the new samples are added with their weights divided by the scale, so that only the
+ * rows of the supported basis functions of the new samples are touched. The stored sums are rescaled
+ * when the scale gets small.
+ */
+void LeastSquaresFitter::addSamples(const DenseMatrix &X, const DenseMatrix &y, const DenseVector &weights)
+{
+    checkSamples(X, y);
+
+    if(weights.size() != X.rows())
+    {
+        throw Exception("LeastSquaresFitter::addSamples: Number of weights does not match the number of points.");
+    }
+
+    if(numAccumulated == 0)
+    {
+        accumulatedRhs.setZero(numCoefficients, y.cols());
+    }
+    else if(y.cols() != accumulatedRhs.cols())
+    {
+        throw Exception("LeastSquaresFitter::addSamples: Number of outputs does not match the accumulated samples.");
+    }
+
+    double decay = std::pow(forgettingFactor, X.rows());
+
+    if(accumulatedScale*decay < 1e-100)
+    {
+        double factor = accumulatedScale*decay;
+        for(auto &value : accumulatedGram)
+        {
+            value *= factor;
+        }
+        accumulatedRhs *= factor;
+        accumulatedScale = 1;
+    }
+    else
+    {
+        accumulatedScale *= decay;
+    }
+
+    DenseVector scaledWeights(X.rows());
+    double forgetting = 1/accumulatedScale;
+    for(int j = X.rows() - 1; j >= 0; j--)
+    {
+        scaledWeights(j) = weights(j)*forgetting;
+        forgetting *= forgettingFactor;
+    }
+
+    accumulateNormalEquations(X, y, scaledWeights, accumulatedGram, accumulatedRhs);
+    numAccumulated += X.rows();
+}
+
+void LeastSquaresFitter::addSamples(const DenseMatrix &X, const DenseMatrix &y)
+{
+    addSamples(X, y, DenseVector::Ones(X.rows()));
+}
+
+void LeastSquaresFitter::setForgettingFactor(double factor)
+{
+    if(!(factor > 0 && factor <= 1))
+    {
+        throw Exception("LeastSquaresFitter::setForgettingFactor: The forgetting factor must be in (0,1].");
+    }
+
+    forgettingFactor = factor;
+}
+
+DenseMatrix LeastSquaresFitter::solveAccumulated()
+{
+    if(numAccumulated == 0)
+    {
+        throw Exception("LeastSquaresFitter::solveAccumulated: No samples have been added.");
+    }
+
+    bool analyzePattern = !accumulatedLDLT;
+    if(analyzePattern)
+    {
+        accumulatedLDLT = std::make_shared< Eigen::SimplicialLDLT<SparseMatrix> >();
+    }
+
+    return solveNormalEquations(accumulatedGram, accumulatedRhs, accumulatedScale, *accumulatedLDLT, analyzePattern);
+}
+
+BSpline LeastSquaresFitter::fitAccumulated()
+{
+    DenseMatrix coefficients = solveAccumulated().transpose();
+
+    std::vector<unsigned int> basisDegrees;
+    for(unsigned int dim = 0; dim < numVariables; dim++)
+    {
+        basisDegrees.push_back(basis.getBasisDegree(dim));
+    }
+
+    return BSpline(coefficients, basis.getKnotVectors(), basisDegrees);
+}
+
+void LeastSquaresFitter::clearAccumulated()
+{
+    accumulatedScale = 1;
+    numAccumulated = 0;
+    accumulatedGram.assign((size_t)numCoefficients*numSlots, 0);
+    accumulatedRhs.resize(0, 0);
+}
+
+void LeastSquaresFitter::checkSamples(const DenseMatrix &X, const DenseMatrix &y) const
+{
+    if(X.cols() != numVariables)
+    {
+        throw Exception("LeastSquaresFitter::checkSamples: Points have wrong dimension.");
+    }
+
+    if(y.rows() != X.rows() || y.cols() < 1)
+    {
+        throw Exception("LeastSquaresFitter::checkSamples: Number of sample values does not match the number of points.");
+    }
+}
+
+/*
+ * Returns the number of blocks in which the samples are processed in parallel, when each block has its own
+ * buffer of blockSize values. The buffers are limited to 2^27 values (1 GB) in total.
+ */
+unsigned int LeastSquaresFitter::numBlocks(unsigned int numSamples, size_t blockSize) const
+{
+    const size_t maxBufferSize = 1 << 27;
+
+    size_t blocks = ThreadPool::getDefault().getNumThreads();
+    blocks = std::min(blocks, std::max<size_t>(1, maxBufferSize/std::max<size_t>(1, blockSize)));
+    blocks = std::min(blocks, std::max<size_t>(1, numSamples/1024));
+
+    return blocks;
+}
+
+template<class Body>
+void LeastSquaresFitter::forEachSample(const DenseMatrix &X, unsigned int begin, unsigned int end, Body body) const
+{
+    std::vector<int> first(numVariables);
+    std::vector<double> univariateValues(basis.numSupportedValues());
+    std::vector<double> values(numSupported);
+    DenseVector x(numVariables);
+
+    for(unsigned int i = begin; i < end; i++)
+    {
+        x = X.row(i).transpose();
+
+        if(!basis.insideSupport(x))
+        {
+            throw Exception("LeastSquaresFitter::solve: Sample outside the support of the basis.");
+        }
+
+        basis.evalSupported(x, first.data(), univariateValues.data(), i > begin);
+
+        // Tensor product of the univariate values, built in place from the last entry down
+        int index = 0;
+        unsigned int size = 1;
+        const double *univariate = univariateValues.data();
+        values[0] = 1;
+        for(unsigned int dim = 0; dim < numVariables; dim++)
+        {
+            int count = basis.getBasisDegree(dim) + 1;
+            for(int a = size - 1; a >= 0; a--)
+            {
+                double weight = values[a];
+                for(int k = count - 1; k >= 0; k--)
+                {
+                    values[a*count + k] = weight*univariate[k];
+                }
+            }
+            size *= count;
+            univariate += count;
+            index += first[dim]*stride[dim];
+        }
+
+        body(i, index, values.data());
+    }
+}
+
+/*
+ * Adds B'*W*B (in band storage) and B'*W*y to gram and rhs. For each sample, the products of the (p+1)^n supported
+ * basis functions are added to the rows of the band storage, so B is never formed. The samples are split into
+ * blocks that are processed in parallel. The first block adds to gram and rhs directly, and the others to their own
+ * copies of the sums, which are then added in a fixed order.
+ */
+void LeastSquaresFitter::accumulateNormalEquations(const DenseMatrix &X, const DenseMatrix &y, const DenseVector &weights, std::vector<double> &gram, DenseMatrix &rhs) const
+{
+    unsigned int numSamples = X.rows();
+    unsigned int numOutputs = y.cols();
+    size_t gramSize = (size_t)numCoefficients*numSlots;
+    unsigned int blocks = numBlocks(numSamples, gramSize + (size_t)numCoefficients*numOutputs);
+
+    std::vector< std::vector<double> > gramBlocks(blocks);
+    std::vector<DenseMatrix> rhsBlocks(blocks);
+
+    parallelBlocks(numSamples, blocks, [&](unsigned int block, unsigned int begin, unsigned int end)
+    {
+        if(block > 0)
+        {
+            gramBlocks.at(block).assign(gramSize, 0);
+            rhsBlocks.at(block).setZero(numCoefficients, numOutputs);
+        }
+
+        std::vector<double> &G = (block > 0) ? gramBlocks.at(block) : gram;
+        DenseMatrix &R = (block > 0) ? rhsBlocks.at(block) : rhs;
+
+        forEachSample(X, begin, end, [&](unsigned int i, int first, const double *values)
+        {
+            double weight = (weights.size() > 0) ? weights(i) : 1;
+
+            for(unsigned int a = 0; a < numSupported; a++)
+            {
+                int row = first + localIndex[a];
+                double value = weight*values[a];
+
+                double *g = G.data() + (size_t)row*numSlots;
+                for(unsigned int k = pairStart[a]; k < pairStart[a+1]; k++)
+                {
+                    g[pairSlot[k]] += value*values[pairOther[k]];
+                }
+
+                for(unsigned int k = 0; k < numOutputs; k++)
+                {
+                    R(row, k) += value*y(i, k);
+                }
+            }
+        });
+    });
+
+    ThreadPool::getDefault().parallelFor(gramSize, 0, [&](unsigned int begin, unsigned int end)
+    {
+        for(unsigned int block = 1; block < blocks; block++)
+        {
+            const std::vector<double> &G = gramBlocks.at(block);
+            for(unsigned int i = begin; i < end; i++)
+            {
+                gram[i] += G[i];
+            }
+        }
+    });
+
+    for(unsigned int block = 1; block < blocks; block++)
+    {
+        rhs += rhsBlocks.at(block);
+    }
+}
+
+/*
+ * Returns B'*B from its band storage. All products of basis functions with overlapping supports are
+ * stored (also those that are zero for the given samples), so the sparsity pattern depends only on the basis.
+ */
+SparseMatrix LeastSquaresFitter::assembleGramMatrix(const std::vector<double> &gram) const
+{
+    unsigned int center = numOffsets/2;
+
+    SparseMatrix BtB(numCoefficients, numCoefficients);
+    BtB.reserve(Eigen::VectorXi::Constant(numCoefficients, numOffsets));
+
+    std::vector<int> index(numVariables, 0); // Tensor index of basis function i
+
+    for(unsigned int i = 0; i < numCoefficients; i++)
+    {
+        // Column i is row i, and the offsets are visited in increasing order of the row index j
+        for(unsigned int o = 0; o < numOffsets; o++)
+        {
+            const int *offset = offsets.data() + o*numVariables;
+
+            int j = i;
+            bool inside = true;
+            for(unsigned int dim = 0; dim < numVariables && inside; dim++)
+            {
+                int jd = index.at(dim) + offset[dim];
+                inside = (jd >= 0 && jd < (int)basis.numBasisFunctions(dim));
+                j += offset[dim]*stride.at(dim);
+            }
+
+            if(inside)
+            {
+                BtB.insert(j, i) = (o >= center) ? gram[(size_t)i*numSlots + o - center] : gram[(size_t)j*numSlots + center - o];
+            }
+        }
+
+        for(int dim = numVariables - 1; dim >= 0; dim--)
+        {
+            if(++index.at(dim) < (int)basis.numBasisFunctions(dim))
+            {
+                break;
+            }
+            index.at(dim) = 0;
+        }
+    }
+
+    BtB.makeCompressed();
+    return BtB;
+}
+
+DenseMatrix LeastSquaresFitter::multiplyBasis(const DenseMatrix &X, const DenseMatrix &c) const
+{
+    DenseMatrix y = DenseMatrix::Zero(X.rows(), c.cols());
+
+    ThreadPool::getDefault().parallelFor(X.rows(), 0, [&](unsigned int begin, unsigned int end)
+    {
+        forEachSample(X, begin, end, [&](unsigned int i, int first, const double *values)
+        {
+            for(unsigned int a = 0; a < numSupported; a++)
+            {
+                for(unsigned int k = 0; k < c.cols(); k++)
+                {
+                    y(i, k) += values[a]*c(first + localIndex[a], k);
+                }
+            }
+        });
+    });
+
+    return y;
+}
+
+DenseMatrix LeastSquaresFitter::multiplyBasisTranspose(const DenseMatrix &X, const DenseMatrix &r) const
+{
+    unsigned int blocks = numBlocks(X.rows(), (size_t)numCoefficients*r.cols());
+    std::vector<DenseMatrix> sums(blocks);
+
+    parallelBlocks(X.rows(), blocks, [&](unsigned int block, unsigned int begin, unsigned int end)
+    {
+        DenseMatrix &sum = sums.at(block);
+        sum.setZero(numCoefficients, r.cols());
+
+        forEachSample(X, begin, end, [&](unsigned int i, int first, const double *values)
+        {
+            for(unsigned int a = 0; a < numSupported; a++)
+            {
+                for(unsigned int k = 0; k < r.cols(); k++)
+                {
+                    sum(first + localIndex[a], k) += values[a]*r(i, k);
+                }
+            }
+        });
+    });
+
+    for(unsigned int block = 1; block < blocks; block++)
+    {
+        sums.at(0) += sums.at(block);
+    }
+
+    return sums.at(0);
+}
+
+/*
+ * LSQR (Paige & Saunders, 1982) for min |A*c - b| with A = [B; sqrt(lambda)*D] and b = [y; 0], run for all
+ * columns of y at once so that each pass over the samples serves all outputs. The columns of A are scaled to
+ * unit norm, which reduces the number of iterations for nonuniform sample densities. A column stops when
+ * |r| <= tol*(|A|*|c| + |b|) (compatible systems) or |A'*r| <= tol*|A|*|r| (least squares solution),
+ * with the estimate of |A| from the bidiagonalization.
+ */
+DenseMatrix LeastSquaresFitter::solveLSQR(const DenseMatrix &X, const DenseMatrix &y) const
+{
+    unsigned int numOutputs = y.cols();
+    bool penalized = penalty.rows() > 0 && lambda > 0;
+    double sqrtLambda = std::sqrt(lambda);
+
+    // Column scaling S = diag(1/|A_j|)
+    DenseVector scale = DenseVector::Zero(numCoefficients);
+    {
+        unsigned int blocks = numBlocks(X.rows(), numCoefficients);
+        std::vector<DenseVector> sums(blocks);
+
+        parallelBlocks(X.rows(), blocks, [&](unsigned int block, unsigned int begin, unsigned int end)
+        {
+            DenseVector &sum = sums.at(block);
+            sum.setZero(numCoefficients);
+
+            forEachSample(X, begin, end, [&](unsigned int, int first, const double *values)
+            {
+                for(unsigned int a = 0; a < numSupported; a++)
+                {
+                    sum(first + localIndex[a]) += values[a]*values[a];
+                }
+            });
+        });
+
+        for(auto &sum : sums)
+        {
+            scale += sum;
+        }
+
+        for(unsigned int j = 0; j < numCoefficients; j++)
+        {
+            if(penalized)
+            {
+                scale(j) += lambda*penalty.col(j).squaredNorm();
+            }
+            scale(j) = scale(j) > 0 ? 1/std::sqrt(scale(j)) : 1;
+        }
+    }
+
+    // Products with A*S and (A*S)', with vectors u = [u1; u2] split as A
+    auto multiply = [&](const DenseMatrix &v, DenseMatrix &u1, DenseMatrix &u2)
+    {
+        DenseMatrix c = scale.asDiagonal()*v;
+        u1 = multiplyBasis(X, c);
+        if(penalized)
+        {
+            u2 = sqrtLambda*(penalty*c);
+        }
+    };
+
+    auto multiplyTranspose = [&](const DenseMatrix &u1, const DenseMatrix &u2) -> DenseMatrix
+    {
+        DenseMatrix v = multiplyBasisTranspose(X, u1);
+        if(penalized)
+        {
+            v += sqrtLambda*(penalty.transpose()*u2);
+        }
+        return scale.asDiagonal()*v;
+    };
+
+    auto columnNorms = [](const DenseMatrix &u1, const DenseMatrix &u2) -> DenseVector
+    {
+        DenseVector norms = u1.colwise().squaredNorm().transpose();
+        if(u2.rows() > 0)
+        {
+            norms += u2.colwise().squaredNorm().transpose();
+        }
+        return norms.cwiseSqrt();
+    };
+
+    auto normalize = [](DenseMatrix &u, const DenseVector &norms)
+    {
+        for(unsigned int k = 0; k < u.cols(); k++)
+        {
+            if(norms(k) > 0)
+            {
+                u.col(k) /= norms(k);
+            }
+        }
+    };
+
+    // Start of the bidiagonalization: beta*u = b, alpha*v = A'*u
+    DenseMatrix U1 = y;
+    DenseMatrix U2 = DenseMatrix::Zero(penalized ? penalty.rows() : 0, numOutputs);
+    DenseVector beta = columnNorms(U1, U2);
+    normalize(U1, beta);
+
+    DenseMatrix V = multiplyTranspose(U1, U2);
+    DenseVector alpha = V.colwise().norm().transpose();
+    normalize(V, alpha);
+
+    DenseMatrix Z = DenseMatrix::Zero(numCoefficients, numOutputs); // Solution of the scaled problem
+    DenseMatrix W = V;
+    DenseVector bnorm = beta;
+    DenseVector phibar = beta;
+    DenseVector rhobar = alpha;
+    DenseVector anorm = DenseVector::Zero(numOutputs);
+
+    std::vector<bool> active(numOutputs);
+    unsigned int numActive = 0;
+    for(unsigned int k = 0; k < numOutputs; k++)
+    {
+        active.at(k) = (beta(k) > 0 && alpha(k) > 0);
+        numActive += active.at(k);
+    }
+
+    unsigned int iteration = 0;
+    for(; iteration < maxIterations && numActive > 0; iteration++)
+    {
+        DenseMatrix AV1, AV2;
+        multiply(V, AV1, AV2);
+        U1 = AV1 - U1*alpha.asDiagonal();
+        if(penalized)
+        {
+            U2 = AV2 - U2*alpha.asDiagonal();
+        }
+        beta = columnNorms(U1, U2);
+        normalize(U1, beta);
+        normalize(U2, beta);
+
+        DenseVector alphaPrevious = alpha;
+        V = multiplyTranspose(U1, U2) - V*beta.asDiagonal();
+        alpha = V.colwise().norm().transpose();
+        normalize(V, alpha);
+
+        for(unsigned int k = 0; k < numOutputs; k++)
+        {
+            if(!active.at(k))
+            {
+                continue;
+            }
+
+            anorm(k) = std::sqrt(anorm(k)*anorm(k) + alphaPrevious(k)*alphaPrevious(k) + beta(k)*beta(k));
+
+            // Plane rotation eliminating beta from the bidiagonal matrix
+            double rho = std::sqrt(rhobar(k)*rhobar(k) + beta(k)*beta(k));
+            double c = rhobar(k)/rho;
+            double s = beta(k)/rho;
+            double theta = s*alpha(k);
+            double phi = c*phibar(k);
+            rhobar(k) = -c*alpha(k);
+            phibar(k) = s*phibar(k);
+
+            Z.col(k) += (phi/rho)*W.col(k);
+            W.col(k) = V.col(k) - (theta/rho)*W.col(k);
+
+            double rnorm = phibar(k);
+            double arnorm = phibar(k)*alpha(k)*std::abs(c);
+
+            if(rnorm <= tol*(anorm(k)*Z.col(k).norm() + bnorm(k)) || arnorm <= tol*anorm(k)*rnorm)
+            {
+                active.at(k) = false;
+                numActive--;
+            }
+        }
+    }
+
+    if(numActive > 0)
+    {
+        throw Exception("LeastSquaresFitter::solveLSQR: LSQR did not converge.");
+    }
+
+#ifndef NDEBUG
+    std::cout << "LSQR converged in " << iteration << " iterations." << std::endl;
+#endif // NDEBUG
+
+    return scale.asDiagonal()*Z;
+}
+
+} // namespace MultivariateSplines
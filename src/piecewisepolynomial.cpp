@@ -0,0 +1,370 @@
+/*
+ * This file is part of the Multivariate Splines library.
+ * Copyright (C) 2012 Bjarne Grimstad (bjarne.grimstad@gmail.com)
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+
+#include "include/piecewisepolynomial.h"
+#include <algorithm>
+#include <iterator>
+
+namespace MultivariateSplines
+{
+
+// Returns k*(k-1)*...*(k-r+1), the factor of t^(k-r) in the r-th derivative of t^k
+static inline double fallingFactorial(int k, unsigned int r)
+{
+    double f = 1;
+    for(unsigned int i = 0; i < r; i++)
+    {
+        f *= k - i;
+    }
+    return f;
+}
+
+static double binomial(unsigned int n, unsigned int k)
+{
+    double b = 1;
+    for(unsigned int i = 1; i <= k; i++)
+    {
+        b = b*(n - k + i)/i;
+    }
+    return b;
+}
+
+/*
+ * Converts the B-spline by inserting all interior knots until they have multiplicity p+1 (all knots of a dimension at once).
+ * The refined B-spline has p+1 coefficients per cell and dimension, which are the
+ * coefficients of the polynomial piece in the Bernstein basis of the cell. These are
+ * then converted to the power basis, one dimension at the time.
+ */
+PiecewisePolynomial::PiecewisePolynomial(const BSpline &bspline)
+    : numVariables(bspline.getNumVariables()),
+      degrees(bspline.getBasisDegrees())
+{
+    if(bspline.getNumOutputs() != 1)
+    {
+        throw Exception("PiecewisePolynomial::PiecewisePolynomial: B-splines with several outputs are not supported.");
+    }
+
+    BSpline bezier(bspline);
+    std::vector< std::vector<double> > knotVectors = bspline.getKnotVectors();
+
+    for(unsigned int dim = 0; dim < numVariables; dim++)
+    {
+        const std::vector<double> &knots = knotVectors.at(dim);
+        unsigned int fullMultiplicity = degrees.at(dim) + 1;
+
+        std::vector<double> distinctKnots;
+        std::unique_copy(knots.begin(), knots.end(), std::back_inserter(distinctKnots));
+
+        std::vector<double> newKnots;
+        for(unsigned int i = 1; i + 1 < distinctKnots.size(); i++)
+        {
+            unsigned int multiplicity = std::count(knots.begin(), knots.end(), distinctKnots.at(i));
+
+            if(multiplicity < fullMultiplicity)
+            {
+                newKnots.insert(newKnots.end(), fullMultiplicity - multiplicity, distinctKnots.at(i));
+            }
+        }
+
+        if(!newKnots.empty() && !bezier.insertKnots(newKnots, dim))
+        {
+            throw Exception("PiecewisePolynomial::PiecewisePolynomial: Knot insertion failed.");
+        }
+
+        breakpoints.push_back(distinctKnots);
+    }
+
+    // Cell and block layout
+    cellStride.resize(numVariables);
+    std::vector<unsigned int> localStride(numVariables);
+    std::vector<unsigned int> numBasisFunctions(numVariables);
+
+    numCells = 1;
+    blockSize = 1;
+    for(int dim = numVariables - 1; dim >= 0; dim--)
+    {
+        cellStride.at(dim) = numCells;
+        localStride.at(dim) = blockSize;
+        numCells *= breakpoints.at(dim).size() - 1;
+        blockSize *= degrees.at(dim) + 1;
+        numBasisFunctions.at(dim) = (breakpoints.at(dim).size() - 1)*(degrees.at(dim) + 1);
+    }
+
+    DenseMatrix controlPoints = bezier.getControlPoints();
+    if(controlPoints.cols() != numCells*blockSize)
+    {
+        throw Exception("PiecewisePolynomial::PiecewisePolynomial: Unexpected number of Bezier coefficients.");
+    }
+
+    // Gather the Bezier coefficients of each cell into a block
+    coefficients.resize(numCells*blockSize);
+    for(unsigned int i = 0; i < numCells*blockSize; i++)
+    {
+        unsigned int remainder = i;
+        unsigned int cell = 0;
+        unsigned int local = 0;
+
+        for(int dim = numVariables - 1; dim >= 0; dim--)
+        {
+            unsigned int index = remainder % numBasisFunctions.at(dim);
+            remainder /= numBasisFunctions.at(dim);
+
+            cell += (index/(degrees.at(dim) + 1))*cellStride.at(dim);
+            local += (index % (degrees.at(dim) + 1))*localStride.at(dim);
+        }
+
+        coefficients.at(cell*blockSize + local) = controlPoints(numVariables, i);
+    }
+
+    // Convert each block from the Bernstein basis to the power basis
+    for(unsigned int cell = 0; cell < numCells; cell++)
+    {
+        for(unsigned int dim = 0; dim < numVariables; dim++)
+        {
+            unsigned int index = (cell/cellStride.at(dim)) % (breakpoints.at(dim).size() - 1);
+            double cellWidth = breakpoints.at(dim).at(index + 1) - breakpoints.at(dim).at(index);
+
+            convertBlock(coefficients.data() + cell*blockSize, dim, cellWidth);
+        }
+    }
+}
+
+/*
+ * Converts the polynomials along dimension dim of a block from the Bernstein basis,
+ * sum_i c_i*binomial(p,i)*s^i*(1-s)^(p-i) with s = t/cellWidth, to the power basis sum_k a_k*t^k.
+ */
+void PiecewisePolynomial::convertBlock(double *block, unsigned int dim, double cellWidth) const
+{
+    unsigned int p = degrees.at(dim);
+    unsigned int m = p + 1;
+
+    unsigned int stride = 1;
+    for(unsigned int d = dim + 1; d < numVariables; d++)
+    {
+        stride *= degrees.at(d) + 1;
+    }
+
+    StackBuffer<double> bernstein(m);
+
+    for(unsigned int start = 0; start < blockSize; start++)
+    {
+        // Visit each polynomial along dim once, from its constant coefficient
+        if((start/stride) % m != 0)
+        {
+            continue;
+        }
+
+        for(unsigned int i = 0; i < m; i++)
+        {
+            bernstein[i] = block[start + i*stride];
+        }
+
+        double scale = 1;
+        for(unsigned int k = 0; k < m; k++)
+        {
+            double a = 0;
+            for(unsigned int i = 0; i <= k; i++)
+            {
+                double sign = ((k - i) % 2 == 0) ? 1 : -1;
+                a += sign*binomial(p, i)*binomial(p - i, k - i)*bernstein[i];
+            }
+
+            block[start + k*stride] = a/scale;
+            scale *= cellWidth;
+        }
+    }
+}
+
+const double* PiecewisePolynomial::locateCell(const DenseVector &x, double *t) const
+{
+    if(x.size() != numVariables)
+    {
+        throw Exception("PiecewisePolynomial::locateCell: Point has wrong dimension.");
+    }
+
+    unsigned int cell = 0;
+
+    for(unsigned int dim = 0; dim < numVariables; dim++)
+    {
+        const std::vector<double> &bp = breakpoints[dim];
+
+        if(!(bp.front() <= x(dim) && x(dim) <= bp.back()))
+        {
+            throw Exception("PiecewisePolynomial::locateCell: Evaluation at point outside domain.");
+        }
+
+        // Cells are half-open, except the last which includes the upper bound
+        int index = std::upper_bound(bp.begin(), bp.end(), x(dim)) - bp.begin() - 1;
+        index = std::min(index, (int)bp.size() - 2);
+
+        t[dim] = x(dim) - bp[index];
+        cell += index*cellStride[dim];
+    }
+
+    return coefficients.data() + cell*blockSize;
+}
+
+/*
+ * Evaluates the partial derivative of the cell polynomial of order orders[d] in variable d, for all d.
+ * The block is reduced one variable at the time, starting with the last: each polynomial
+ * in the last variable is evaluated with Horner's method, giving a block of one dimension less.
+ * The buffer work must hold blockSize values.
+ */
+double PiecewisePolynomial::evalCell(const double *block, const double *t, const unsigned int *orders, double *work) const
+{
+    const double *source = block;
+    unsigned int size = blockSize;
+
+    for(int dim = numVariables - 1; dim >= 0; dim--)
+    {
+        int p = degrees[dim];
+        unsigned int order = orders[dim];
+        size /= p + 1;
+
+        double ti = t[dim];
+
+        if(order == 0)
+        {
+            for(unsigned int i = 0; i < size; i++)
+            {
+                const double *c = source + i*(p + 1);
+
+                double value = c[p];
+                for(int k = p - 1; k >= 0; k--)
+                {
+                    value = value*ti + c[k];
+                }
+
+                work[i] = value;
+            }
+        }
+        else
+        {
+            for(unsigned int i = 0; i < size; i++)
+            {
+                const double *c = source + i*(p + 1);
+
+                double value = 0;
+                for(int k = p; k >= (int)order; k--)
+                {
+                    value = value*ti + fallingFactorial(k, order)*c[k];
+                }
+
+                work[i] = value;
+            }
+        }
+
+        source = work;
+    }
+
+    return source[0];
+}
+
+double PiecewisePolynomial::eval(DenseVector x) const
+{
+    StackBuffer<double> t(numVariables);
+    StackBuffer<double> work(blockSize);
+    StackBuffer<unsigned int> orders(numVariables);
+
+    for(unsigned int dim = 0; dim < numVariables; dim++)
+    {
+        orders[dim] = 0;
+    }
+
+    const double *block = locateCell(x, t.data());
+
+    return evalCell(block, t.data(), orders.data(), work.data());
+}
+
+/*
+ * Returns the Jacobian evaluated at x.
+ * The Jacobian is an 1 x n matrix,
+ * where n is the dimension of x.
+ */
+DenseMatrix PiecewisePolynomial::evalJacobian(DenseVector x) const
+{
+    StackBuffer<double> t(numVariables);
+    StackBuffer<double> work(blockSize);
+    StackBuffer<unsigned int> orders(numVariables);
+
+    for(unsigned int dim = 0; dim < numVariables; dim++)
+    {
+        orders[dim] = 0;
+    }
+
+    const double *block = locateCell(x, t.data());
+
+    DenseMatrix J(1, numVariables);
+    for(unsigned int i = 0; i < numVariables; i++)
+    {
+        orders[i] = 1;
+        J(0,i) = evalCell(block, t.data(), orders.data(), work.data());
+        orders[i] = 0;
+    }
+
+    return J;
+}
+
+/*
+ * Returns the Hessian evaluated at x.
+ * The Hessian is an n x n matrix,
+ * where n is the dimension of x.
+ */
+DenseMatrix PiecewisePolynomial::evalHessian(DenseVector x) const
+{
+    StackBuffer<double> t(numVariables);
+    StackBuffer<double> work(blockSize);
+    StackBuffer<unsigned int> orders(numVariables);
+
+    for(unsigned int dim = 0; dim < numVariables; dim++)
+    {
+        orders[dim] = 0;
+    }
+
+    const double *block = locateCell(x, t.data());
+
+    DenseMatrix H(numVariables, numVariables);
+    for(unsigned int i = 0; i < numVariables; i++)
+    {
+        for(unsigned int j = 0; j <= i; j++)
+        {
+            orders[i]++;
+            orders[j]++;
+            H(i,j) = evalCell(block, t.data(), orders.data(), work.data());
+            H(j,i) = H(i,j);
+            orders[i]--;
+            orders[j]--;
+        }
+    }
+
+    return H;
+}
+
+std::vector<double> PiecewisePolynomial::getDomainUpperBound() const
+{
+    std::vector<double> ub;
+    for(auto &bp : breakpoints)
+    {
+        ub.push_back(bp.back());
+    }
+    return ub;
+}
+
+std::vector<double> PiecewisePolynomial::getDomainLowerBound() const
+{
+    std::vector<double> lb;
+    for(auto &bp : breakpoints)
+    {
+        lb.push_back(bp.front());
+    }
+    return lb;
+}
+
+} // namespace MultivariateSplines
@@ -9,7 +9,7 @@
 
 
 #include "pspline.h"
-#include "include/linearsolvers.h"
+#include "include/bsplinefitter.h"
 
 namespace MultivariateSplines
 {
@@ -39,87 +39,51 @@ PSpline::PSpline(const DataTable &samples, double lambda)
     checkControlPoints();
 }
 
-void PSpline::computeControlPoints(const DataTable &samples)
+PSpline::PSpline(const DataTable &samples, SmoothingCriterion criterion)
 {
-    // Assuming regular grid
-    unsigned int numSamples = samples.getNumSamples();
-
-    /* Setup and solve equations Lc = R,
-     * L = B'*W*B + l*D'*D
-     * R = B'*W*y
-     * c = control coefficients or knot averages.
-     * B = basis functions at sample x-values,
-     * W = weighting matrix for interpolating specific points
-     * D = second-order finite difference matrix
-     * l = penalizing parameter (increase for more smoothing)
-     * y = sample y-values when calculating control coefficients,
-     * y = sample x-values when calculating knot averages
-     */
-
-    SparseMatrix L, B, D, W;
-    DenseMatrix Rx, Ry, Bx, By;
-
-    // Weight matrix
-    W.resize(numSamples, numSamples);
-    W.setIdentity();
-
-    // Basis function matrix
-    computeBasisFunctionMatrix(samples, B);
-
-    // Second order finite difference matrix
-    getSecondOrderFiniteDifferenceMatrix(D);
-
-    // Left-hand side matrix
-    L = B.transpose()*W*B + lambda*D.transpose()*D;
-
-    // Compute right-hand side matrices
-    controlPointEquationRHS(samples, Bx, By);
-    Rx = B.transpose()*W*Bx;
-    Ry = B.transpose()*W*By;
-
-    // Matrices to store the resulting coefficients
-    DenseMatrix Cx, Cy;
+    if(!samples.isGridComplete())
+    {
+        throw Exception("PSpline::PSpline: Cannot create P-spline from irregular (incomplete) grid.");
+    }
 
-    int numEquations = L.rows();
-    int maxNumEquations = pow(2,10);
+    std::vector< std::vector<double> > xdata = samples.getTableX();
 
-    bool solveAsDense = (numEquations < maxNumEquations);
+    numVariables = samples.getNumVariables();
 
-    if (!solveAsDense)
-    {
-#ifndef NDEBUG
-        std::cout << "Computing B-spline control points using sparse solver." << std::endl;
-#endif // NDEBUG
+    std::vector<unsigned int> basisDegrees(samples.getNumVariables(), 3);
+    basis = BSplineBasis(xdata, basisDegrees, KnotVectorType::FREE);
 
-        SparseLU s;
-        bool successfulSolve = (s.solve(L,Rx,Cx) && s.solve(L,Ry,Cy));
+    lambda = BSplineFitter::selectLambda(samples, basis, criterion);
+    computeControlPoints(samples);
 
-        solveAsDense = !successfulSolve;
-    }
+    init();
 
-    if (solveAsDense)
-    {
-#ifndef NDEBUG
-        std::cout << "Computing B-spline control points using dense solver." << std::endl;
-#endif // NDEBUG
+    checkControlPoints();
+}
 
-        DenseMatrix Ld = L.toDense();
-        DenseQR s;
-        bool successfulSolve = s.solve(Ld, Rx, Cx) && s.solve(Ld, Ry, Cy);
+void PSpline::computeControlPoints(const DataTable &samples)
+{
+    /* Setup and solve equations Lc = R,
+     * L = B'*B + l*D'*D
+     * R = B'*y
+     * c = control coefficients
+     * B = basis functions at sample x-values,
+     * D = second-order finite difference matrix
+     * l = penalizing parameter (increase for more smoothing)
+     * y = sample y-values
+     * On a complete grid with one sample per grid point, B and D are not formed (see BSplineFitter).
+     */
+    BSplineFitter fitter(samples, basis, lambda);
 
-        if(!successfulSolve)
-        {
-            throw Exception("PSpline::computeControlPoints: Failed to solve for B-spline coefficients.");
-        }
-    }
+    std::vector<double> y = samples.getVectorY();
+    coefficients = fitter.solve(Eigen::Map<DenseVector>(y.data(), y.size())).transpose();
 
-    coefficients = Cy.transpose();
-    knotaverages = Cx.transpose();
+    computeKnotAverages();
 }
 
 // Function for generating second order finite-difference matrix, which is used for penalizing the
 // (approximate) second derivative in control point calculation for P-splines.
-void PSpline::getSecondOrderFiniteDifferenceMatrix(SparseMatrix &D)
+void PSpline::getSecondOrderFiniteDifferenceMatrix(const BSplineBasis &basis, SparseMatrix &D)
 {
 
     // Number of (total) basis functions - defines the number of columns in D
@@ -155,6 +155,16 @@ double RBFSpline::eval(std::vector<double> x) const
     return normalized ? sumw/sum : sumw;
 }
 
+DenseMatrix RBFSpline::evalJacobian(DenseVector) const
+{
+    throw Exception("RBFSpline::evalJacobian: Not implemented.");
+}
+
+DenseMatrix RBFSpline::evalHessian(DenseVector) const
+{
+    throw Exception("RBFSpline::evalHessian: Not implemented.");
+}
+
 /*
  * TODO: test for errors
  */
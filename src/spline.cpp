@@ -0,0 +1,64 @@
+/*
+ * This file is part of the Multivariate Splines library.
+ * Copyright (C) 2012 Bjarne Grimstad (bjarne.grimstad@gmail.com)
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+
+#include "include/spline.h"
+#include "include/threadpool.h"
+
+namespace MultivariateSplines
+{
+
+void Spline::evalBatch(const DenseMatrix &X, DenseVector &y) const
+{
+    y.resize(X.rows());
+
+    ThreadPool::getDefault().parallelFor(X.rows(), 0, [&](unsigned int begin, unsigned int end)
+    {
+        DenseVector x(X.cols());
+        for(unsigned int i = begin; i < end; i++)
+        {
+            x = X.row(i).transpose();
+            y(i) = eval(x);
+        }
+    });
+}
+
+void Spline::evalJacobianBatch(const DenseMatrix &X, DenseMatrix &J) const
+{
+    J.resize(X.rows(), X.cols());
+
+    ThreadPool::getDefault().parallelFor(X.rows(), 0, [&](unsigned int begin, unsigned int end)
+    {
+        DenseVector x(X.cols());
+        for(unsigned int i = begin; i < end; i++)
+        {
+            x = X.row(i).transpose();
+            J.row(i) = evalJacobian(x);
+        }
+    });
+}
+
+void Spline::evalHessianBatch(const DenseMatrix &X, DenseMatrix &H) const
+{
+    unsigned int numVariables = X.cols();
+    H.resize(X.rows(), numVariables*numVariables);
+
+    ThreadPool::getDefault().parallelFor(X.rows(), 0, [&](unsigned int begin, unsigned int end)
+    {
+        DenseVector x(numVariables);
+        for(unsigned int i = begin; i < end; i++)
+        {
+            x = X.row(i).transpose();
+            DenseMatrix Hi = evalHessian(x);
+            H.row(i) = Eigen::Map<const DenseVector>(Hi.data(), Hi.size()).transpose();
+        }
+    });
+}
+
+} // namespace MultivariateSplines
@@ -0,0 +1,269 @@
+/*
+ * This file is part of the Multivariate Splines library.
+ * Copyright (C) 2012 Bjarne Grimstad (bjarne.grimstad@gmail.com)
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+
+#include "include/threadpool.h"
+#include <algorithm>
+
+namespace MultivariateSplines
+{
+
+// True for the threads that are currently running chunks of a parallelFor
+static thread_local bool insideParallelFor = false;
+
+static std::mutex defaultPoolMutex;
+static std::unique_ptr<ThreadPool> defaultPool;
+
+ThreadPool::ThreadPool()
+{
+    init(std::thread::hardware_concurrency());
+}
+
+ThreadPool::ThreadPool(unsigned int numThreads)
+{
+    init(numThreads);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    wakeUp.notify_all();
+
+    for(auto &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::init(unsigned int numThreads)
+{
+    this->numThreads = std::max(numThreads, 1u);
+    body = nullptr;
+    numIterations = 0;
+    chunkSize = 1;
+    generation = 0;
+    numBusy = 0;
+    stop = false;
+
+    for(unsigned int i = 0; i < this->numThreads; i++)
+    {
+        queues.push_back(std::unique_ptr<ChunkQueue>(new ChunkQueue));
+        queues.back()->begin = 0;
+        queues.back()->end = 0;
+    }
+
+    for(unsigned int i = 1; i < this->numThreads; i++)
+    {
+        workers.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+    }
+}
+
+void ThreadPool::parallelFor(unsigned int n, unsigned int chunkSize, const std::function<void(unsigned int, unsigned int)> &body)
+{
+    if(n == 0)
+    {
+        return;
+    }
+
+    // Nested calls and single-threaded pools run serially
+    if(insideParallelFor || numThreads == 1)
+    {
+        body(0, n);
+        return;
+    }
+
+    std::lock_guard<std::mutex> jobLock(jobMutex);
+
+    // Aim for a few chunks per thread to leave room for stealing
+    if(chunkSize == 0)
+    {
+        chunkSize = std::max(1u, n/(8*numThreads));
+    }
+
+    unsigned int numChunks = (n + chunkSize - 1)/chunkSize;
+
+    // Distribute chunks evenly among the threads
+    for(unsigned int i = 0; i < numThreads; i++)
+    {
+        std::lock_guard<std::mutex> queueLock(queues[i]->mutex);
+        queues[i]->begin = (unsigned long)i*numChunks/numThreads;
+        queues[i]->end = (unsigned long)(i+1)*numChunks/numThreads;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->body = &body;
+        this->numIterations = n;
+        this->chunkSize = chunkSize;
+        this->error = nullptr;
+        numBusy = numThreads - 1;
+        generation++;
+    }
+    wakeUp.notify_all();
+
+    // The calling thread is thread 0
+    insideParallelFor = true;
+    runChunks(0);
+    insideParallelFor = false;
+
+    std::exception_ptr jobError;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [this]() { return numBusy == 0; });
+        this->body = nullptr;
+        jobError = this->error;
+    }
+
+    if(jobError)
+    {
+        std::rethrow_exception(jobError);
+    }
+}
+
+void ThreadPool::workerLoop(unsigned int id)
+{
+    insideParallelFor = true;
+    unsigned long lastGeneration = 0;
+
+    while(true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeUp.wait(lock, [&]() { return stop || generation != lastGeneration; });
+
+            if(stop)
+            {
+                return;
+            }
+
+            lastGeneration = generation;
+        }
+
+        runChunks(id);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            numBusy--;
+            if(numBusy == 0)
+            {
+                finished.notify_one();
+            }
+        }
+    }
+}
+
+void ThreadPool::runChunks(unsigned int id)
+{
+    unsigned int chunk;
+
+    while(true)
+    {
+        if(!popChunk(id, chunk))
+        {
+            // Done when there are no chunks left to steal
+            if(!stealChunks(id))
+            {
+                break;
+            }
+            continue;
+        }
+
+        bool failed;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            failed = (bool)error;
+        }
+
+        // After a failure the remaining chunks are drained without doing any work
+        if(failed)
+        {
+            continue;
+        }
+
+        unsigned int begin = chunk*chunkSize;
+        unsigned int end = std::min(numIterations, begin + chunkSize);
+
+        try
+        {
+            (*body)(begin, end);
+        }
+        catch(...)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(!error)
+            {
+                error = std::current_exception();
+            }
+        }
+    }
+}
+
+bool ThreadPool::popChunk(unsigned int id, unsigned int &chunk)
+{
+    ChunkQueue &queue = *queues[id];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+
+    if(queue.begin < queue.end)
+    {
+        chunk = queue.begin++;
+        return true;
+    }
+    return false;
+}
+
+// Moves half of the remaining chunks of another thread to the (empty) queue of thread id
+bool ThreadPool::stealChunks(unsigned int id)
+{
+    for(unsigned int i = 1; i < numThreads; i++)
+    {
+        ChunkQueue &victim = *queues[(id + i) % numThreads];
+        unsigned int begin, end;
+        {
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if(victim.begin >= victim.end)
+            {
+                continue;
+            }
+
+            unsigned int numStolen = (victim.end - victim.begin + 1)/2;
+            end = victim.end;
+            begin = end - numStolen;
+            victim.end = begin;
+        }
+
+        ChunkQueue &queue = *queues[id];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.begin = begin;
+        queue.end = end;
+        return true;
+    }
+
+    return false;
+}
+
+ThreadPool &ThreadPool::getDefault()
+{
+    std::lock_guard<std::mutex> lock(defaultPoolMutex);
+    if(!defaultPool)
+    {
+        defaultPool = std::unique_ptr<ThreadPool>(new ThreadPool());
+    }
+    return *defaultPool;
+}
+
+void ThreadPool::setDefaultNumThreads(unsigned int numThreads)
+{
+    std::lock_guard<std::mutex> lock(defaultPoolMutex);
+    defaultPool = std::unique_ptr<ThreadPool>(new ThreadPool(numThreads));
+}
+
+} // namespace MultivariateSplines
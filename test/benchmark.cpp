@@ -0,0 +1,233 @@
+/*
+ * This file is part of the Multivariate Splines library.
+ * Copyright (C) 2012 Bjarne Grimstad (bjarne.grimstad@gmail.com)
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include <vector>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+
+#include "bspline.h"
+#include "bsplineminimizer.h"
+#include "datatable.h"
+#include "threadpool.h"
+
+using std::cout;
+using std::endl;
+
+using namespace MultivariateSplines;
+
+typedef std::chrono::steady_clock Clock;
+
+double secondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// B-spline with random coefficients and equidistant knots on [0,1]^numVariables
+BSpline randomBSpline(unsigned int numVariables, unsigned int degree, unsigned int numBasisFunctions, std::mt19937 &rng)
+{
+    std::uniform_real_distribution<double> coefficientDistribution(-1, 1);
+
+    std::vector< std::vector<double> > knotVectors;
+    std::vector<unsigned int> degrees(numVariables, degree);
+    unsigned int numCoefficients = 1;
+
+    for(unsigned int dim = 0; dim < numVariables; dim++)
+    {
+        std::vector<double> knots(degree, 0.0);
+        unsigned int numIntervals = numBasisFunctions - degree;
+        for(unsigned int i = 0; i <= numIntervals; i++)
+        {
+            knots.push_back((double)i/numIntervals);
+        }
+        for(unsigned int i = 0; i < degree; i++)
+        {
+            knots.push_back(1.0);
+        }
+
+        knotVectors.push_back(knots);
+        numCoefficients *= numBasisFunctions;
+    }
+
+    DenseMatrix coefficients(1, numCoefficients);
+    for(unsigned int i = 0; i < numCoefficients; i++)
+    {
+        coefficients(0,i) = coefficientDistribution(rng);
+    }
+
+    return BSpline(coefficients, knotVectors, degrees);
+}
+
+/*
+ * Measures evaluation throughput (points per second) of the B-spline for degrees 1-3
+ * and 1-6 variables, using
+ * 1) a loop over eval,
+ * 2) evalBatch on a single thread (vectorized over points), and
+ * 3) evalBatch on all hardware threads.
+ */
+void runEvaluationBenchmark()
+{
+    std::mt19937 rng(2015);
+    std::uniform_real_distribution<double> pointDistribution(0, 1);
+
+    const unsigned int numPoints = 200000;
+    const unsigned int maxNumCoefficients = 1000000;
+
+    cout << endl << endl;
+    cout << "B-spline evaluation throughput (million points per second)" << endl;
+    cout << "----------------------------------------------------------" << endl;
+    cout << std::setw(8) << "degree" << std::setw(8) << "vars"
+         << std::setw(14) << "eval loop" << std::setw(14) << "batch (1 th)"
+         << std::setw(14) << "batch (all)" << endl;
+
+    unsigned int numThreads = ThreadPool::getDefault().getNumThreads();
+
+    for(unsigned int degree = 1; degree <= 3; degree++)
+    {
+        for(unsigned int numVariables = 1; numVariables <= 6; numVariables++)
+        {
+            unsigned int numBasisFunctions = std::pow((double)maxNumCoefficients, 1.0/numVariables);
+            numBasisFunctions = std::max(degree + 2, std::min(numBasisFunctions, 100u));
+
+            BSpline bspline = randomBSpline(numVariables, degree, numBasisFunctions, rng);
+
+            DenseMatrix X(numPoints, numVariables);
+            for(unsigned int i = 0; i < numPoints; i++)
+            {
+                for(unsigned int j = 0; j < numVariables; j++)
+                {
+                    X(i,j) = pointDistribution(rng);
+                }
+            }
+
+            // Loop over eval
+            DenseVector yLoop(numPoints);
+            DenseVector x(numVariables);
+            auto start = Clock::now();
+            for(unsigned int i = 0; i < numPoints; i++)
+            {
+                x = X.row(i).transpose();
+                yLoop(i) = bspline.eval(x);
+            }
+            double timeLoop = secondsSince(start);
+
+            // Batch evaluation on one thread
+            DenseVector yBatch;
+            ThreadPool::setDefaultNumThreads(1);
+            start = Clock::now();
+            bspline.evalBatch(X, yBatch);
+            double timeBatch = secondsSince(start);
+
+            // Batch evaluation on all threads
+            ThreadPool::setDefaultNumThreads(numThreads);
+            start = Clock::now();
+            bspline.evalBatch(X, yBatch);
+            double timeParallel = secondsSince(start);
+
+            double error = (yLoop - yBatch).cwiseAbs().maxCoeff();
+            if(error > 1e-10)
+            {
+                cout << "Batch evaluation differs from eval by " << error << endl;
+            }
+
+            cout << std::setw(8) << degree << std::setw(8) << numVariables << std::fixed << std::setprecision(2)
+                 << std::setw(14) << 1e-6*numPoints/timeLoop
+                 << std::setw(14) << 1e-6*numPoints/timeBatch
+                 << std::setw(14) << 1e-6*numPoints/timeParallel << endl;
+        }
+    }
+
+    cout << "----------------------------------------------------------" << endl;
+    cout << "Threads: " << numThreads << endl;
+}
+
+// Six-hump camelback function
+double camelback(const DenseVector &x)
+{
+    return (4 - 2.1*x(0)*x(0) + (1/3.)*x(0)*x(0)*x(0)*x(0))*x(0)*x(0) + x(0)*x(1) + (-4 + 4*x(1)*x(1))*x(1)*x(1);
+}
+
+/*
+ * Measures the node throughput of the branch-and-bound minimizer on cubic B-splines of the six-hump
+ * camelback function on [-2,2]x[-1,1], sampled on grids of increasing size, on one and on all threads.
+ */
+void runMinimizationBenchmark()
+{
+    const double tol = 1e-8;
+
+    cout << endl << endl;
+    cout << "Branch-and-bound minimization of the six-hump camelback B-spline" << endl;
+    cout << "------------------------------------------------------------------------------" << endl;
+    cout << std::setw(10) << "grid" << std::setw(8) << "nodes" << std::setw(8) << "rounds"
+         << std::setw(14) << "minimum" << std::setw(12) << "gap"
+         << std::setw(14) << "nodes/s (1)" << std::setw(14) << "nodes/s (all)" << endl;
+
+    unsigned int numThreads = ThreadPool::getDefault().getNumThreads();
+
+    for(unsigned int gridSize : {20, 50, 100, 200})
+    {
+        DataTable samples;
+        DenseVector x(2);
+        for(unsigned int i = 0; i < gridSize; i++)
+        {
+            for(unsigned int j = 0; j < gridSize; j++)
+            {
+                x(0) = -2 + 4.0*i/(gridSize - 1);
+                x(1) = -1 + 2.0*j/(gridSize - 1);
+                samples.addSample(x, camelback(x));
+            }
+        }
+        BSpline bspline(samples, BSplineType::CUBIC_FREE);
+
+        ThreadPool::setDefaultNumThreads(1);
+        BSplineMinimizer serial(bspline);
+        serial.setTolerance(tol);
+        serial.minimize();
+
+        ThreadPool::setDefaultNumThreads(numThreads);
+        BSplineMinimizer parallel(bspline);
+        parallel.setTolerance(tol);
+        parallel.minimize();
+
+        if(parallel.getNumNodes() != serial.getNumNodes() || parallel.getMinimum() != serial.getMinimum())
+        {
+            cout << "Parallel minimization differs from serial minimization" << endl;
+        }
+
+        cout << std::setw(6) << gridSize << "^2  " << std::setw(8) << parallel.getNumNodes() << std::setw(8) << parallel.getNumRounds()
+             << std::setw(14) << std::setprecision(8) << parallel.getMinimum()
+             << std::setw(12) << std::setprecision(2) << std::scientific << parallel.getMinimum() - parallel.getLowerBound() << std::defaultfloat
+             << std::setw(14) << std::setprecision(0) << std::fixed << serial.getNodesPerSecond()
+             << std::setw(14) << parallel.getNodesPerSecond() << std::defaultfloat << endl;
+    }
+
+    cout << "------------------------------------------------------------------------------" << endl;
+    cout << "Threads: " << numThreads << endl;
+}
+
+int main(int argc, char **argv)
+{
+    try
+    {
+        runEvaluationBenchmark();
+        runMinimizationBenchmark();
+    }
+    catch(MultivariateSplines::Exception& e)
+    {
+        cout << "MS Exception - " << e.what() << endl;
+    }
+    catch(std::exception& e)
+    {
+        cout << "std::exception - " << e.what() << endl;
+    }
+
+    return 0;
+}
@@ -16,10 +16,21 @@
 #include <iomanip>
 #include <string>
 #include <cstdio>
+#include <algorithm>
+#include <random>
 
 #include "bspline.h"
+#include "bsplineevaluator.h"
+#include "bsplineview.h"
+#include "piecewisepolynomial.h"
 #include "pspline.h"
+#include "bsplinefitter.h"
+#include "bsplineminimizer.h"
+#include "leastsquaresfitter.h"
 #include "rbfspline.h"
+#include "linearsolvers.h"
+#include "threadpool.h"
+#include "unsupported/Eigen/KroneckerProduct"
 
 using std::cout;
 using std::endl;
@@ -577,12 +588,1521 @@ void testSplineDerivative()
     cout << "Test finished successfully!" << endl;
 }
 
+void testSplineHessian()
+{
+    cout << endl << endl;
+    cout << "Testing spline Hessian..." << endl;
+
+    // Samples of a function of three variables with mixed terms
+    DataTable samples;
+    DenseVector x(3);
+    for(auto x0 : linspace(0, 2, 7))
+    {
+        for(auto x1 : linspace(0, 2, 7))
+        {
+            for(auto x2 : linspace(0, 2, 7))
+            {
+                x(0) = x0;
+                x(1) = x1;
+                x(2) = x2;
+                samples.addSample(x, std::sin(x0)*x1 + x0*x1*x2 + x2*x2*x2);
+            }
+        }
+    }
+
+    double tol = 1e-5;  // Relative error tolerance
+    double h = 1e-6;    // Finite difference step length
+
+    for(auto type : {BSplineType::LINEAR, BSplineType::QUADRATIC_FREE, BSplineType::CUBIC_FREE})
+    {
+        BSpline spline(samples, type);
+
+        // Points away from the knots (at the sample points), where the derivatives may jump
+        for(auto t : linspace(0.05, 1.95, 20))
+        {
+            x(0) = t;
+            x(1) = 2 - t;
+            x(2) = std::fmod(3*t, 2.0);
+
+            DenseMatrix H = spline.evalHessian(x);
+            if(H.rows() != 3 || H.cols() != 3)
+            {
+                cout << "Test failed - check Hessian size!" << endl;
+                return;
+            }
+
+            // Compare with central differences of the Jacobian
+            for(unsigned int j = 0; j < 3; j++)
+            {
+                DenseVector xf = x; xf(j) += h;
+                DenseVector xb = x; xb(j) -= h;
+                DenseMatrix diff = (spline.evalJacobian(xf) - spline.evalJacobian(xb))/(2*h);
+
+                for(unsigned int i = 0; i < 3; i++)
+                {
+                    if(std::abs(H(i,j) - diff(i)) > tol*std::max(1.0, std::abs(diff(i)))
+                        || H(i,j) != H(j,i))
+                    {
+                        cout << "Test failed - check Hessian!" << endl;
+                        return;
+                    }
+                }
+            }
+
+            // Fused evaluation must agree with the separate calls
+            double value;
+            DenseMatrix J, H2;
+            spline.evalAll(x, value, J, H2);
+            if(value != spline.eval(x) || J != spline.evalJacobian(x) || H2 != H)
+            {
+                cout << "Test failed - check evalAll!" << endl;
+                return;
+            }
+        }
+    }
+
+    cout << "Test finished successfully!" << endl;
+}
+
+void testKnotIntervalLookup()
+{
+    cout << endl << endl;
+    cout << "Testing knot interval lookup..." << endl;
+
+    // Equidistant knots (direct lookup) and knots with an interior double knot (search)
+    std::vector<double> samples = linspace(-1, 2.3, 31);
+    std::vector<double> knots = {0, 0, 0, 0.1, 0.5, 0.5, 1.2, 1.3, 2, 2, 2};
+
+    std::vector<BSplineBasis1D> bases;
+    bases.push_back(BSplineBasis1D(samples, 3, KnotVectorType::EQUIDISTANT));
+    bases.push_back(BSplineBasis1D(knots, 2, KnotVectorType::EXPLICIT));
+
+    for(auto &basis : bases)
+    {
+        const std::vector<double> &t = basis.getKnotVector();
+
+        // Increasing points including all knots, followed by a few decreasing points
+        std::vector<double> x = linspace(t.front(), t.back(), 997);
+        x.insert(x.end(), t.begin(), t.end());
+        std::sort(x.begin(), x.end());
+        x.push_back(t.back());
+        x.push_back(0.5*(t.front() + t.back()));
+        x.push_back(t.front());
+
+        std::vector<int> indices;
+        basis.indexHalfopenIntervals(x, indices);
+
+        int previous = -1;
+        for(unsigned int i = 0; i < x.size(); i++)
+        {
+            int expected = std::upper_bound(t.begin(), t.end(), x.at(i)) - t.begin() - 1;
+
+            if(basis.indexHalfopenInterval(x.at(i)) != expected
+                || basis.indexHalfopenInterval(x.at(i), previous) != expected
+                || indices.at(i) != expected)
+            {
+                cout << "Test failed - check knot interval of " << x.at(i) << "!" << endl;
+                return;
+            }
+
+            previous = expected;
+        }
+    }
+
+    cout << "Test finished successfully!" << endl;
+}
+
+void testPiecewisePolynomial()
+{
+    cout << endl << endl;
+    cout << "Testing piecewise polynomial conversion..." << endl;
+
+    DataTable samples;
+    DenseVector x(2);
+    for(auto x0 : linspace(-2, 2, 11))
+    {
+        for(auto x1 : linspace(-1, 1, 8))
+        {
+            x(0) = x0;
+            x(1) = x1;
+            samples.addSample(x, f(x));
+        }
+    }
+
+    for(auto type : {BSplineType::LINEAR, BSplineType::QUADRATIC_FREE, BSplineType::CUBIC_FREE})
+    {
+        BSpline bspline(samples, type);
+        PiecewisePolynomial polynomial(bspline);
+
+        // Includes the domain corners and points on the knots
+        for(auto x0 : linspace(-2, 2, 41))
+        {
+            for(auto x1 : linspace(-1, 1, 29))
+            {
+                x(0) = x0;
+                x(1) = x1;
+
+                double tol = 1e-10*std::max(1.0, std::abs(bspline.eval(x)));
+                if(std::abs(polynomial.eval(x) - bspline.eval(x)) > tol
+                    || (polynomial.evalJacobian(x) - bspline.evalJacobian(x)).cwiseAbs().maxCoeff() > 1e3*tol
+                    || (polynomial.evalHessian(x) - bspline.evalHessian(x)).cwiseAbs().maxCoeff() > 1e5*tol)
+                {
+                    cout << "Test failed - check piecewise polynomial at " << x0 << ", " << x1 << "!" << endl;
+                    return;
+                }
+            }
+        }
+    }
+
+    cout << "Test finished successfully!" << endl;
+}
+
+void testKnotInsertion()
+{
+    cout << endl << endl;
+    cout << "Testing knot insertion..." << endl;
+
+    // B-spline in three variables with two outputs
+    DataTable samples;
+    DenseVector x(3);
+    for(auto x0 : linspace(0, 2, 7))
+    {
+        for(auto x1 : linspace(0, 1, 6))
+        {
+            for(auto x2 : linspace(-1, 1, 5))
+            {
+                x(0) = x0;
+                x(1) = x1;
+                x(2) = x2;
+                samples.addSample(x, std::sin(x0)*std::cos(3*x1) + x2*x2);
+            }
+        }
+    }
+
+    BSplineFitter fitter(samples, BSplineType::CUBIC_FREE);
+    DenseMatrix y(samples.getNumSamples(), 2);
+    std::vector<double> yv = samples.getVectorY();
+    for(unsigned int i = 0; i < yv.size(); i++)
+    {
+        y(i,0) = yv.at(i);
+        y(i,1) = yv.at(i)*yv.at(i);
+    }
+    BSpline original = fitter.refit(y);
+
+    // Knots in two dimensions at once, and one at the time
+    BSpline batched = original, sequential = original;
+    std::vector< std::vector<double> > knots = {{0.5, 0.5, 1.3}, {}, {0.1, -0.2}};
+    bool inserted = batched.insertKnots(knots);
+    inserted = inserted && sequential.insertKnots(0.5, 0, 2);
+    inserted = inserted && sequential.insertKnots(1.3, 0);
+    inserted = inserted && sequential.insertKnots(0.1, 2);
+    inserted = inserted && sequential.insertKnots(-0.2, 2);
+
+    if(!inserted
+       || batched.getControlPoints().cols() != original.getControlPoints().cols()/(7*5)*(10*7)
+       || (batched.getControlPoints() - sequential.getControlPoints()).cwiseAbs().maxCoeff() > 1e-12)
+    {
+        cout << "Test failed - check batched knot insertion!" << endl;
+        return;
+    }
+
+    // The B-spline is unchanged by knot insertion
+    std::mt19937 generator(4);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    for(unsigned int i = 0; i < 100; i++)
+    {
+        x << 2*uniform(generator), uniform(generator), 2*uniform(generator) - 1;
+        if((batched.evalVector(x) - original.evalVector(x)).cwiseAbs().maxCoeff() > 1e-10)
+        {
+            cout << "Test failed - check knot insertion!" << endl;
+            return;
+        }
+    }
+
+    // Knots with too high multiplicity are rejected, and the B-spline is left unchanged
+    BSpline rejected = original;
+    if(rejected.insertKnots({{}, {0.5, 0.5, 0.5}, {0.3, 0.3, 0.3, 0.3, 0.3}})
+       || rejected.getControlPoints() != original.getControlPoints())
+    {
+        cout << "Test failed - check rejected knot insertion!" << endl;
+        return;
+    }
+
+    cout << "Test finished successfully!" << endl;
+}
+
+void testKroneckerSolver()
+{
+    cout << endl << endl;
+    cout << "Testing Kronecker product solver..." << endl;
+
+    // Three banded factors of different sizes
+    std::vector<SparseMatrix> factors;
+    for(unsigned int m : {5, 7, 4})
+    {
+        SparseMatrix factor(m, m);
+        for(unsigned int i = 0; i < m; i++)
+        {
+            factor.insert(i, i) = 4 + i;
+            if(i > 0) factor.insert(i, i-1) = -1;
+            if(i + 1 < m) factor.insert(i, i+1) = 2;
+        }
+        factor.makeCompressed();
+        factors.push_back(factor);
+    }
+
+    DenseMatrix A01 = kroneckerProduct(DenseMatrix(factors.at(0)), DenseMatrix(factors.at(1)));
+    DenseMatrix A = kroneckerProduct(A01, DenseMatrix(factors.at(2)));
+    DenseMatrix b = DenseMatrix::Random(A.rows(), 2);
+
+    DenseMatrix x;
+    KroneckerSolver solver(factors);
+    if(!solver.solve(b, x) || (A*x - b).norm() > 1e-10*b.norm())
+    {
+        cout << "Test failed - check Kronecker solver!" << endl;
+        return;
+    }
+
+    cout << "Test finished successfully!" << endl;
+}
+
+void testLinearSolvers()
+{
+    cout << endl << endl;
+    cout << "Testing symmetric positive definite solvers..." << endl;
+
+    // Shifted 2D Laplacian on a 30 x 30 grid, and a nonsymmetric perturbation of it
+    unsigned int m = 30;
+    SparseMatrix A(m*m, m*m), B(m*m, m*m);
+    for(unsigned int i = 0; i < m; i++)
+    {
+        for(unsigned int j = 0; j < m; j++)
+        {
+            unsigned int k = i*m + j;
+            A.insert(k, k) = 4.1;
+            B.insert(k, k) = 4.1;
+            if(j > 0) { A.insert(k, k-1) = -1; B.insert(k, k-1) = -1; }
+            if(j + 1 < m) { A.insert(k, k+1) = -1; B.insert(k, k+1) = -0.5; }
+            if(i > 0) { A.insert(k, k-m) = -1; B.insert(k, k-m) = -1; }
+            if(i + 1 < m) { A.insert(k, k+m) = -1; B.insert(k, k+m) = -1; }
+        }
+    }
+    A.makeCompressed();
+    B.makeCompressed();
+
+    if(selectLinearSolver(A, true) != LinearSolverType::SPARSE_LDLT
+       || selectLinearSolver(A, true, 128, 1000) != LinearSolverType::SPARSE_CG
+       || selectLinearSolver(A) != LinearSolverType::SPARSE_LU
+       || selectLinearSolver(B, true) != LinearSolverType::SPARSE_LU
+       || selectLinearSolver(SparseMatrix(A.topRows(100)), true) != LinearSolverType::SPARSE_QR)
+    {
+        cout << "Test failed - check solver selection!" << endl;
+        return;
+    }
+
+    DenseMatrix b = DenseMatrix::Random(m*m, 2);
+    DenseMatrix x1, x2, x3, x4;
+
+    try
+    {
+        SparseLDLT ldlt;
+        SparseCG cg;
+        SparseAutoSolver automatic(true);
+        SparseAutoSolver unchecked;
+        unchecked.setResidualCheck(false);
+
+        ldlt.solve(A, b, x1);
+        cg.solve(A, b, x2);
+        automatic.solve(A, b, x3);
+        unchecked.solve(B, b, x4);
+    }
+    catch(Exception &e)
+    {
+        cout << "Test failed - " << e.what() << endl;
+        return;
+    }
+
+    if((A*x1 - b).norm() > 1e-10*b.norm()
+       || (A*x2 - b).norm() > 1e-10*b.norm()
+       || (A*x3 - b).norm() > 1e-10*b.norm()
+       || (B*x4 - b).norm() > 1e-10*b.norm())
+    {
+        cout << "Test failed - check symmetric positive definite solvers!" << endl;
+        return;
+    }
+
+    cout << "Test finished successfully!" << endl;
+}
+
+void testBSplineFitter()
+{
+    cout << endl << endl;
+    cout << "Testing B-spline refitting..." << endl;
+
+    // Two sets of sample values on the same grid
+    DataTable samples, samples2;
+    DenseVector x(2);
+    for(auto x0 : linspace(0, 2, 40))
+    {
+        for(auto x1 : linspace(0, 1, 30))
+        {
+            x(0) = x0;
+            x(1) = x1;
+            samples.addSample(x, f(x));
+            samples2.addSample(x, std::sin(x0)*std::cos(3*x1));
+        }
+    }
+
+    BSplineFitter interpolation(samples, BSplineType::CUBIC_FREE);
+    BSplineFitter smoothing(samples, 0.1);
+
+    std::vector<BSpline> refitted = {interpolation.refit(samples2), smoothing.refit(samples2)};
+    std::vector<BSpline> expected = {BSpline(samples2, BSplineType::CUBIC_FREE), PSpline(samples2, 0.1)};
+
+    for(unsigned int k = 0; k < refitted.size(); k++)
+    {
+        DenseMatrix difference = refitted.at(k).getControlPoints() - expected.at(k).getControlPoints();
+        if(difference.cwiseAbs().maxCoeff() > 1e-10)
+        {
+            cout << "Test failed - check refitted control points!" << endl;
+            return;
+        }
+    }
+
+    // The residual check of the fitter can be tightened and disabled
+    std::vector< std::vector<double> > gridPoints = samples.getTableX();
+    BSplineBasis cubicBasis(gridPoints, std::vector<unsigned int>(2, 3), KnotVectorType::FREE);
+    SparseMatrix penalty;
+    PSpline::getSecondOrderFiniteDifferenceMatrix(cubicBasis, penalty);
+
+    BSplineFitter explicitPenalty(samples, cubicBasis, penalty, 0.1);
+    explicitPenalty.setTolerance(0);
+    try
+    {
+        explicitPenalty.refit(samples2);
+        cout << "Test failed - check residual tolerance of the fitter!" << endl;
+        return;
+    }
+    catch(Exception &e)
+    {
+    }
+
+    explicitPenalty.setResidualCheck(false);
+    explicitPenalty.refit(samples2);
+
+    // P-spline in three variables, fitted without forming B and D, and with an explicit penalty matrix
+    DataTable samples3;
+    DenseVector x3(3);
+    for(auto x0 : linspace(0, 2, 9))
+    {
+        for(auto x1 : linspace(0, 1, 7))
+        {
+            for(auto x2 : linspace(-1, 1, 6))
+            {
+                x3(0) = x0;
+                x3(1) = x1;
+                x3(2) = x2;
+                samples3.addSample(x3, std::sin(x0)*std::cos(3*x1) + x2*x2);
+            }
+        }
+    }
+
+    std::vector< std::vector<double> > xdata = samples3.getTableX();
+    BSplineBasis basis(xdata, std::vector<unsigned int>(3, 3), KnotVectorType::FREE);
+    SparseMatrix D;
+    PSpline::getSecondOrderFiniteDifferenceMatrix(basis, D);
+
+    // The matrix-free fitter can change lambda without being set up again
+    BSplineFitter reused(samples3, basis, 1.0);
+
+    for(double lambda : {0.001, 0.1, 10.0})
+    {
+        BSplineFitter matrixFree(samples3, basis, lambda);
+        BSplineFitter assembled(samples3, basis, D, lambda);
+
+        DenseMatrix difference = matrixFree.refit(samples3).getControlPoints() - assembled.refit(samples3).getControlPoints();
+        if(difference.cwiseAbs().maxCoeff() > 1e-8)
+        {
+            cout << "Test failed - check matrix-free P-spline fit!" << endl;
+            return;
+        }
+
+        if(!reused.setLambda(lambda) || assembled.setLambda(lambda)
+           || (reused.refit(samples3).getControlPoints() - assembled.refit(samples3).getControlPoints()).cwiseAbs().maxCoeff() > 1e-8)
+        {
+            cout << "Test failed - check change of smoothing parameter!" << endl;
+            return;
+        }
+    }
+
+    cout << "Test finished successfully!" << endl;
+}
+
+void testSmoothingParameterSelection()
+{
+    cout << endl << endl;
+    cout << "Testing automatic selection of the P-spline smoothing parameter..." << endl;
+
+    auto g = [](double x0, double x1) { return std::sin(3*x0)*std::cos(2*x1); };
+
+    // Noisy samples on grids with 400 and 625 coefficients (exact and estimated trace)
+    for(unsigned int n : {20, 25})
+    {
+        std::mt19937 generator(1);
+        std::normal_distribution<double> noise(0, 0.1);
+
+        DataTable samples;
+        DenseVector x(2);
+        for(auto x0 : linspace(0, 2, n))
+        {
+            for(auto x1 : linspace(0, 2, n))
+            {
+                x(0) = x0;
+                x(1) = x1;
+                samples.addSample(x, g(x0, x1) + noise(generator));
+            }
+        }
+
+        // Root mean square error with respect to the noise-free function
+        auto error = [&](const BSpline &spline)
+        {
+            double sum = 0;
+            unsigned int m = 0;
+            DenseVector z(2);
+            for(auto z0 : linspace(0.01, 1.99, 25))
+            {
+                for(auto z1 : linspace(0.01, 1.99, 25))
+                {
+                    z(0) = z0;
+                    z(1) = z1;
+                    sum += std::pow(spline.eval(z) - g(z0, z1), 2);
+                    m++;
+                }
+            }
+            return std::sqrt(sum/m);
+        };
+
+        double worst = std::max(error(PSpline(samples, 1e-4)), error(PSpline(samples, 1e4)));
+
+        std::vector<SmoothingCriterion> criteria = {SmoothingCriterion::GCV};
+        if(n == 20)
+        {
+            criteria.push_back(SmoothingCriterion::REML);
+        }
+
+        for(auto criterion : criteria)
+        {
+            PSpline pspline(samples, criterion);
+
+            if(!(error(pspline) < 0.5*worst) || pspline.getLambda() <= 1e-6 || pspline.getLambda() >= 1e6)
+            {
+                cout << "Test failed - check smoothing parameter selection!" << endl;
+                return;
+            }
+        }
+    }
+
+    cout << "Test finished successfully!" << endl;
+}
+
+void testLeastSquaresFitter()
+{
+    cout << endl << endl;
+    cout << "Testing least squares fit to scattered samples..." << endl;
+
+    // Cubic basis with nonuniform knot vectors on [0,2] x [0,1]
+    std::vector< std::vector<double> > knots = {{0, 0, 0, 0, 0.3, 0.7, 1, 1.5, 2, 2, 2, 2},
+                                                {0, 0, 0, 0, 0.2, 0.5, 0.6, 1, 1, 1, 1}};
+    BSplineBasis basis(knots, std::vector<unsigned int>(2, 3), KnotVectorType::EXPLICIT);
+
+    // Scattered samples of a cubic polynomial (reproduced exactly by the basis) and of a smooth function
+    auto cubic = [](double x0, double x1) { return 1 + x0 - 2*x1*x1 + x0*x0*x1 + 0.5*x0*x1*x1*x1; };
+
+    std::mt19937 generator(2);
+    std::uniform_real_distribution<double> uniform(0, 1);
+
+    unsigned int n = 5000;
+    DenseMatrix X(n, 2), y(n, 2);
+    for(unsigned int i = 0; i < n; i++)
+    {
+        X(i,0) = 2*uniform(generator);
+        X(i,1) = uniform(generator);
+        y(i,0) = cubic(X(i,0), X(i,1));
+        y(i,1) = std::sin(X(i,0))*std::cos(3*X(i,1));
+    }
+
+    // Normal equations without forming B
+    LeastSquaresFitter fitter(basis);
+
+    SparseMatrix BtB;
+    DenseMatrix Bty;
+    fitter.computeNormalEquations(X, y, BtB, Bty);
+
+    SparseMatrix B(n, basis.numBasisFunctions());
+    for(unsigned int i = 0; i < n; i++)
+    {
+        SparseVector values = basis.eval(X.row(i).transpose());
+        for(SparseVector::InnerIterator it(values); it; ++it)
+        {
+            B.insert(i, it.index()) = it.value();
+        }
+    }
+
+    DenseMatrix BtBExpected = B.transpose()*B;
+    DenseMatrix BtyExpected = B.transpose()*y;
+    if((DenseMatrix(BtB) - BtBExpected).cwiseAbs().maxCoeff() > 1e-10*BtBExpected.cwiseAbs().maxCoeff()
+       || (Bty - BtyExpected).cwiseAbs().maxCoeff() > 1e-10*BtyExpected.cwiseAbs().maxCoeff())
+    {
+        cout << "Test failed - check normal equations!" << endl;
+        return;
+    }
+
+    // Cholesky and LSQR, without and with a penalty
+    for(double lambda : {0.0, 0.1})
+    {
+        LeastSquaresFitter cholesky = (lambda > 0) ? LeastSquaresFitter(basis, lambda) : LeastSquaresFitter(basis);
+        LeastSquaresFitter lsqr = cholesky;
+        lsqr.setSolver(LeastSquaresSolver::LSQR);
+
+        BSpline spline = cholesky.fit(X, y);
+        DenseMatrix difference = spline.getControlPoints() - lsqr.fit(X, y).getControlPoints();
+
+        if(difference.cwiseAbs().maxCoeff() > 1e-6)
+        {
+            cout << "Test failed - check LSQR solution!" << endl;
+            return;
+        }
+
+        if(lambda == 0)
+        {
+            DenseVector z(2);
+            for(unsigned int i = 0; i < 100; i++)
+            {
+                z(0) = 2*uniform(generator);
+                z(1) = uniform(generator);
+                if(std::abs(spline.evalVector(z)(0) - cubic(z(0), z(1))) > 1e-8)
+                {
+                    cout << "Test failed - check least squares fit!" << endl;
+                    return;
+                }
+            }
+        }
+    }
+
+    // Samples in a DataTable with an incomplete grid
+    DataTable samples(false, true);
+    for(unsigned int i = 0; i < n; i++)
+    {
+        samples.addSample(DenseVector(X.row(i).transpose()), y(i,1));
+    }
+
+    DenseMatrix difference = fitter.fit(samples).getControlPoints() - fitter.fit(X, y.col(1)).getControlPoints();
+    if(difference.cwiseAbs().maxCoeff() > 1e-10)
+    {
+        cout << "Test failed - check fit to DataTable!" << endl;
+        return;
+    }
+
+    // Without samples in [1.5,2] x [0,1], the normal equations are singular unless a penalty is used
+    std::vector<unsigned int> rows;
+    for(unsigned int i = 0; i < n; i++)
+    {
+        if(X(i,0) < 1.5)
+        {
+            rows.push_back(i);
+        }
+    }
+
+    DenseMatrix Xgap(rows.size(), 2), ygap(rows.size(), 1);
+    for(unsigned int i = 0; i < rows.size(); i++)
+    {
+        Xgap.row(i) = X.row(rows.at(i));
+        ygap(i,0) = y(rows.at(i), 1);
+    }
+
+    bool singular = false;
+    try
+    {
+        fitter.fit(Xgap, ygap);
+    }
+    catch(Exception &)
+    {
+        singular = true;
+    }
+
+    BSpline smoothed = LeastSquaresFitter(basis, 0.01).fit(Xgap, ygap);
+    DenseVector z(2);
+    z << 1, 0.5;
+
+    if(!singular || std::abs(smoothed.eval(z) - std::sin(1.0)*std::cos(1.5)) > 1e-2)
+    {
+        cout << "Test failed - check penalized fit to samples with a gap!" << endl;
+        return;
+    }
+
+    cout << "Test finished successfully!" << endl;
+}
+
+void testIncrementalLeastSquaresFit()
+{
+    cout << endl << endl;
+    cout << "Testing incremental least squares fit..." << endl;
+
+    std::vector< std::vector<double> > knots = {{0, 0, 0, 0, 0.25, 0.5, 0.75, 1, 1, 1, 1},
+                                                {0, 0, 0, 0, 0.5, 1, 1, 1, 1}};
+    BSplineBasis basis(knots, std::vector<unsigned int>(2, 3), KnotVectorType::EXPLICIT);
+
+    std::mt19937 generator(3);
+    std::uniform_real_distribution<double> uniform(0, 1);
+
+    auto sampleFunction = [&](unsigned int n, double phase, DenseMatrix &X, DenseMatrix &y)
+    {
+        X.resize(n, 2);
+        y.resize(n, 1);
+        for(unsigned int i = 0; i < n; i++)
+        {
+            X(i,0) = uniform(generator);
+            X(i,1) = uniform(generator);
+            y(i,0) = std::sin(4*X(i,0) + phase)*std::cos(2*X(i,1));
+        }
+    };
+
+    DenseMatrix X, y;
+    sampleFunction(3000, 0, X, y);
+
+    // Samples added one by one and in mini-batches give the batch fit
+    LeastSquaresFitter batch(basis, 0.01);
+    DenseMatrix expected = batch.solve(X, y);
+
+    LeastSquaresFitter online(basis, 0.01);
+    unsigned int begin = 0;
+    for(unsigned int size : {1, 1, 7, 100, 2891})
+    {
+        online.addSamples(X.middleRows(begin, size), y.middleRows(begin, size));
+        begin += size;
+
+        if(size == 100 && (online.solveAccumulated() - LeastSquaresFitter(basis, 0.01).solve(X.topRows(begin), y.topRows(begin))).cwiseAbs().maxCoeff() > 1e-10)
+        {
+            cout << "Test failed - check incremental fit!" << endl;
+            return;
+        }
+    }
+
+    if(online.getNumAccumulatedSamples() != 3000 || (online.solveAccumulated() - expected).cwiseAbs().maxCoeff() > 1e-10)
+    {
+        cout << "Test failed - check incremental fit!" << endl;
+        return;
+    }
+
+    // Adding the samples again doubles their weight, which is the same as weight 2
+    online.addSamples(X, y);
+    LeastSquaresFitter weighted(basis, 0.01);
+    weighted.addSamples(X, y, DenseVector::Constant(X.rows(), 2));
+
+    if((online.solveAccumulated() - weighted.solveAccumulated()).cwiseAbs().maxCoeff() > 1e-10)
+    {
+        cout << "Test failed - check weighted incremental fit!" << endl;
+        return;
+    }
+
+    // With forgetting, the fit follows a changing function. The result does not depend on the batch sizes.
+    LeastSquaresFitter forgetting(basis), forgettingBatches(basis);
+    forgetting.setForgettingFactor(0.999);
+    forgettingBatches.setForgettingFactor(0.999);
+
+    DenseMatrix X2, y2;
+    sampleFunction(20000, 1, X2, y2);
+
+    forgetting.addSamples(X, y);
+    forgetting.addSamples(X2, y2);
+    for(unsigned int i = 0; i < X.rows(); i += 500)
+    {
+        forgettingBatches.addSamples(X.middleRows(i, 500), y.middleRows(i, 500));
+    }
+    for(unsigned int i = 0; i < X2.rows(); i += 1000)
+    {
+        forgettingBatches.addSamples(X2.middleRows(i, 1000), y2.middleRows(i, 1000));
+    }
+
+    BSpline current = forgetting.fitAccumulated();
+    DenseMatrix difference = current.getControlPoints() - forgettingBatches.fitAccumulated().getControlPoints();
+
+    DenseVector z(2);
+    z << 0.3, 0.6;
+    if(difference.cwiseAbs().maxCoeff() > 1e-8 || std::abs(current.eval(z) - std::sin(2.2)*std::cos(1.2)) > 1e-2)
+    {
+        cout << "Test failed - check forgetting factor!" << endl;
+        return;
+    }
+
+    cout << "Test finished successfully!" << endl;
+}
+
+void testMultipleOutputs()
+{
+    cout << endl << endl;
+    cout << "Testing B-splines with several outputs..." << endl;
+
+    // Three quantities sampled on the same grid
+    DataTable samples;
+    DenseMatrix Y(25*20, 3);
+    DenseVector x(2);
+    unsigned int i = 0;
+    for(auto x0 : linspace(0, 2, 25))
+    {
+        for(auto x1 : linspace(0, 1, 20))
+        {
+            x(0) = x0;
+            x(1) = x1;
+            samples.addSample(x, f(x));
+            Y(i,0) = f(x);
+            Y(i,1) = std::sin(x0)*std::cos(3*x1);
+            Y(i,2) = x0*x0 - x1;
+            i++;
+        }
+    }
+
+    BSplineFitter fitter(samples, BSplineType::CUBIC_FREE);
+    BSpline multiple = fitter.refit(Y);
+
+    if(multiple.getNumOutputs() != 3)
+    {
+        cout << "Test failed - check number of outputs!" << endl;
+        return;
+    }
+
+    // Compare with one B-spline per output
+    std::vector<BSpline> single;
+    for(unsigned int k = 0; k < 3; k++)
+    {
+        single.push_back(fitter.refit(DenseMatrix(Y.col(k))));
+    }
+
+    for(auto x0 : linspace(0.01, 1.99, 13))
+    {
+        for(auto x1 : linspace(0.01, 0.99, 11))
+        {
+            x(0) = x0;
+            x(1) = x1;
+
+            DenseVector y = multiple.evalVector(x);
+            DenseMatrix J = multiple.evalJacobian(x);
+
+            for(unsigned int k = 0; k < 3; k++)
+            {
+                DenseMatrix Jk = single.at(k).evalJacobian(x);
+                if(std::abs(y(k) - single.at(k).eval(x)) > 1e-12
+                   || (J.row(k) - Jk).cwiseAbs().maxCoeff() > 1e-10)
+                {
+                    cout << "Test failed - check evaluation of several outputs!" << endl;
+                    return;
+                }
+            }
+        }
+    }
+
+    cout << "Test finished successfully!" << endl;
+}
+
+void testBatchEvaluation()
+{
+    cout << endl << endl;
+    cout << "Testing batch evaluation..." << endl;
+
+    DataTable samples;
+
+    auto x0_vec = linspace(0, 2, 20);
+    auto x1_vec = linspace(0, 2, 20);
+    DenseVector x(2);
+
+    for(auto x0 : x0_vec)
+    {
+        for(auto x1 : x1_vec)
+        {
+            x(0) = x0;
+            x(1) = x1;
+            samples.addSample(x, f(x));
+        }
+    }
+
+    BSpline bspline(samples, BSplineType::CUBIC_FREE);
+    PSpline pspline(samples, 0.03);
+    RBFSpline rbfspline(samples, RadialBasisFunctionType::THIN_PLATE_SPLINE);
+
+    // Points on a 50 x 50 grid
+    auto x_vec = linspace(0, 2, 50);
+    DenseMatrix X(x_vec.size()*x_vec.size(), 2);
+    unsigned int n = 0;
+    for(auto x0 : x_vec)
+    {
+        for(auto x1 : x_vec)
+        {
+            X(n,0) = x0;
+            X(n,1) = x1;
+            n++;
+        }
+    }
+
+    std::vector<Spline*> splines = {&bspline, &pspline, &rbfspline};
+
+    for(unsigned int k = 0; k < splines.size(); k++)
+    {
+        DenseVector y;
+        splines.at(k)->evalBatch(X, y);
+
+        DenseMatrix J, H;
+        if(k < 2)
+        {
+            splines.at(k)->evalJacobianBatch(X, J);
+            splines.at(k)->evalHessianBatch(X, H);
+        }
+        else
+        {
+            // The derivatives of the RBF spline are not implemented
+            unsigned int numThrown = 0;
+            try
+            {
+                splines.at(k)->evalJacobianBatch(X, J);
+            }
+            catch(Exception &)
+            {
+                numThrown++;
+            }
+            try
+            {
+                splines.at(k)->evalHessianBatch(X, H);
+            }
+            catch(Exception &)
+            {
+                numThrown++;
+            }
+
+            if(numThrown != 2)
+            {
+                cout << "Test failed - batch derivatives of RBF spline should throw!" << endl;
+                return;
+            }
+        }
+
+        for(unsigned int i = 0; i < n; i++)
+        {
+            x = X.row(i).transpose();
+
+            bool equal = std::abs(y(i) - splines.at(k)->eval(x)) <= 1e-12;
+
+            if(k < 2)
+            {
+                DenseMatrix Ji = splines.at(k)->evalJacobian(x);
+                DenseMatrix Hi = splines.at(k)->evalHessian(x);
+                equal = equal && (J.row(i) - Ji).cwiseAbs().maxCoeff() <= 1e-12;
+                equal = equal && std::abs(H(i,1) - Hi(1,0)) <= 1e-12 && std::abs(H(i,3) - Hi(1,1)) <= 1e-12;
+            }
+
+            if(!equal)
+            {
+                cout << "Test failed - batch evaluation differs from evaluation at x = " << x.transpose() << endl;
+                return;
+            }
+        }
+    }
+
+    cout << "Test finished successfully!" << endl;
+}
+
+void testBSplineEvaluator()
+{
+    cout << endl << endl;
+    cout << "Testing compile-time B-spline evaluator..." << endl;
+
+    DataTable samples;
+
+    auto x0_vec = linspace(0, 2, 20);
+    auto x1_vec = linspace(0, 2, 20);
+    DenseVector x(2);
+
+    for(auto x0 : x0_vec)
+    {
+        for(auto x1 : x1_vec)
+        {
+            x(0) = x0;
+            x(1) = x1;
+            samples.addSample(x, f(x));
+        }
+    }
+
+    BSpline bspline(samples, BSplineType::CUBIC_FREE);
+    BSplineEvaluator<2,3> evaluator(bspline);
+
+    auto x_vec = linspace(0, 2, 50);
+    for(auto x0 : x_vec)
+    {
+        for(auto x1 : x_vec)
+        {
+            x(0) = x0;
+            x(1) = x1;
+
+            DenseMatrix J = bspline.evalJacobian(x);
+            BSplineEvaluator<2,3>::Jacobian Je = evaluator.evalJacobian(x);
+
+            if(std::abs(bspline.eval(x) - evaluator.eval(x)) > 1e-12
+                || std::abs(J(0) - Je(0)) > 1e-10
+                || std::abs(J(1) - Je(1)) > 1e-10)
+            {
+                cout << "Test failed - evaluator differs from B-spline at x = " << x.transpose() << endl;
+                return;
+            }
+        }
+    }
+
+    cout << "Test finished successfully!" << endl;
+}
+
+void testDomainReduction()
+{
+    cout << endl << endl;
+    cout << "Testing domain reduction..." << endl;
+
+    // B-spline in three variables with two outputs
+    DataTable samples;
+    DenseVector x(3);
+    for(auto x0 : linspace(0, 2, 9))
+    {
+        for(auto x1 : linspace(0, 1, 7))
+        {
+            for(auto x2 : linspace(-1, 1, 8))
+            {
+                x(0) = x0;
+                x(1) = x1;
+                x(2) = x2;
+                samples.addSample(x, std::sin(x0)*std::cos(3*x1) + x2*x2);
+            }
+        }
+    }
+
+    BSplineFitter fitter(samples, BSplineType::CUBIC_FREE);
+    DenseMatrix y(samples.getNumSamples(), 2);
+    std::vector<double> yv = samples.getVectorY();
+    for(unsigned int i = 0; i < yv.size(); i++)
+    {
+        y(i,0) = yv.at(i);
+        y(i,1) = std::exp(yv.at(i));
+    }
+    BSpline original = fitter.refit(y);
+
+    // Make the knot vectors (p+1)-regular at the new bounds, so that basis functions are removed
+    std::vector<double> lb = {0.4, 0.1, -0.6}, ub = {1.6, 0.7, 0.9};
+    BSpline regular = original;
+    for(unsigned int dim = 0; dim < 3; dim++)
+    {
+        if(!regular.insertKnots({lb.at(dim), lb.at(dim), lb.at(dim), lb.at(dim), ub.at(dim), ub.at(dim), ub.at(dim), ub.at(dim)}, dim))
+        {
+            cout << "Test failed - check knot insertion!" << endl;
+            return;
+        }
+    }
+
+    BSpline reduced = regular;
+    reduced.reduceDomain(lb, ub, false);
+
+    // The retained control points equal those selected by the Kronecker product of univariate selection matrices
+    std::vector< std::vector<double> > knotVectors = regular.getKnotVectors();
+    BSplineBasis basis(knotVectors, regular.getBasisDegrees(), KnotVectorType::EXPLICIT);
+    SparseMatrix A;
+    if(!basis.reduceSupport(lb, ub, A))
+    {
+        cout << "Test failed - check selection matrix!" << endl;
+        return;
+    }
+
+    DenseMatrix selected = regular.getControlPoints()*A;
+    if(selected.cols() >= regular.getControlPoints().cols()
+       || selected.rows() != reduced.getControlPoints().rows()
+       || selected.cols() != reduced.getControlPoints().cols()
+       || selected != reduced.getControlPoints())
+    {
+        cout << "Test failed - check retained control points!" << endl;
+        return;
+    }
+
+    // The reduced B-spline equals the original on the reduced domain
+    std::mt19937 generator(5);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    for(unsigned int i = 0; i < 100; i++)
+    {
+        for(unsigned int dim = 0; dim < 3; dim++)
+            x(dim) = lb.at(dim) + (ub.at(dim) - lb.at(dim))*uniform(generator);
+
+        if((reduced.evalVector(x) - original.evalVector(x)).cwiseAbs().maxCoeff() > 1e-10)
+        {
+            cout << "Test failed - check domain reduction!" << endl;
+            return;
+        }
+    }
+
+    cout << "Test finished successfully!" << endl;
+}
+
+void testBSplineView()
+{
+    cout << endl << endl;
+    cout << "Testing B-spline views..." << endl;
+
+    // B-spline in two variables with two outputs
+    DataTable samples;
+    DenseVector x(2);
+    for(auto x0 : linspace(-1, 1, 12))
+    {
+        for(auto x1 : linspace(0, 2, 10))
+        {
+            x(0) = x0;
+            x(1) = x1;
+            samples.addSample(x, std::sin(2*x0)*x1 + x1*x1);
+        }
+    }
+
+    BSplineFitter fitter(samples, BSplineType::CUBIC_FREE);
+    DenseMatrix y(samples.getNumSamples(), 2);
+    std::vector<double> yv = samples.getVectorY();
+    for(unsigned int i = 0; i < yv.size(); i++)
+    {
+        y(i,0) = yv.at(i);
+        y(i,1) = std::cos(yv.at(i));
+    }
+    BSpline original = fitter.refit(y);
+
+    // Nested views share the B-spline of the root
+    BSplineView root(original);
+    BSplineView node = root.subdomain({-0.5, 0.3}, {0.6, 1.4});
+    BSplineView leaf = node.subdomain({-0.2, 0.3}, {0.1, 0.9});
+
+    if(&node.getBSpline() != &root.getBSpline()
+       || &leaf.getBSpline() != &root.getBSpline()
+       || !(leaf.getNumControlPoints() < node.getNumControlPoints() && node.getNumControlPoints() < root.getNumControlPoints())
+       || root.getControlPoints() != original.getControlPoints())
+    {
+        cout << "Test failed - check shared storage!" << endl;
+        return;
+    }
+
+    // Many views of one B-spline only store their bounds and index ranges
+    std::vector<BSplineView> nodes(10000, leaf);
+    if(nodes.back().getNumControlPoints() != leaf.getNumControlPoints() || !leaf.isShared())
+    {
+        cout << "Test failed - check copies of views!" << endl;
+        return;
+    }
+    nodes.clear();
+
+    // On the box, a view equals the B-spline, and its values are bounded by its control points
+    DenseMatrix controlPoints = leaf.getControlPoints();
+    DenseVector lower = controlPoints.bottomRows(2).rowwise().minCoeff();
+    DenseVector upper = controlPoints.bottomRows(2).rowwise().maxCoeff();
+    BSpline reduced = leaf.toBSpline();
+
+    std::mt19937 generator(6);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    for(unsigned int i = 0; i < 100; i++)
+    {
+        x << -0.2 + 0.3*uniform(generator), 0.3 + 0.6*uniform(generator);
+
+        DenseVector value = leaf.evalVector(x);
+        if((value - original.evalVector(x)).cwiseAbs().maxCoeff() > 1e-12
+           || (reduced.evalVector(x) - value).cwiseAbs().maxCoeff() > 1e-10
+           || (value - lower).minCoeff() < -1e-12
+           || (upper - value).minCoeff() < -1e-12)
+        {
+            cout << "Test failed - check evaluation of views!" << endl;
+            return;
+        }
+    }
+
+    // Evaluation outside the box is rejected
+    x << 0.5, 0.5;
+    try
+    {
+        leaf.eval(x);
+        cout << "Test failed - check domain of views!" << endl;
+        return;
+    }
+    catch(Exception &e)
+    {
+    }
+
+    // Knot insertion gives the view its own B-spline, reduced to the box, and the other views are unchanged
+    DenseMatrix nodeControlPoints = node.getControlPoints();
+    if(!leaf.insertKnots({{-0.05, 0.0}, {0.6}})
+       || &leaf.getBSpline() == &root.getBSpline()
+       || leaf.isShared()
+       || node.getControlPoints() != nodeControlPoints
+       || leaf.getBSpline().getDomainLowerBound() != leaf.getDomainLowerBound()
+       || leaf.getBSpline().getDomainUpperBound() != leaf.getDomainUpperBound())
+    {
+        cout << "Test failed - check copy-on-write!" << endl;
+        return;
+    }
+
+    for(unsigned int i = 0; i < 100; i++)
+    {
+        x << -0.2 + 0.3*uniform(generator), 0.3 + 0.6*uniform(generator);
+        if((leaf.evalVector(x) - original.evalVector(x)).cwiseAbs().maxCoeff() > 1e-10)
+        {
+            cout << "Test failed - check knot insertion in views!" << endl;
+            return;
+        }
+    }
+
+    cout << "Test finished successfully!" << endl;
+}
+
+void testBSplineBounds()
+{
+    cout << endl << endl;
+    cout << "Testing bounds over boxes..." << endl;
+
+    // B-spline in two variables with two outputs
+    DataTable samples;
+    DenseVector x(2);
+    for(auto x0 : linspace(-1, 1, 12))
+    {
+        for(auto x1 : linspace(0, 2, 10))
+        {
+            x(0) = x0;
+            x(1) = x1;
+            samples.addSample(x, std::sin(3*x0)*x1 - x1*x1);
+        }
+    }
+
+    BSplineFitter fitter(samples, BSplineType::CUBIC_FREE);
+    DenseMatrix y(samples.getNumSamples(), 2);
+    std::vector<double> yv = samples.getVectorY();
+    for(unsigned int i = 0; i < yv.size(); i++)
+    {
+        y(i,0) = yv.at(i);
+        y(i,1) = std::exp(yv.at(i));
+    }
+    BSpline bspline = fitter.refit(y);
+
+    std::mt19937 generator(7);
+    std::uniform_real_distribution<double> uniform(0, 1);
+
+    unsigned int numBoxes = 20;
+    DenseMatrix LB(numBoxes, 2), UB(numBoxes, 2);
+
+    for(unsigned int i = 0; i < numBoxes; i++)
+    {
+        // Random box, a box that is a line segment, one on the upper face of the domain and one touching it
+        double a0 = -1 + 2*uniform(generator), b0 = -1 + 2*uniform(generator);
+        double a1 = 2*uniform(generator), b1 = 2*uniform(generator);
+        std::vector<double> lb = {std::min(a0, b0), std::min(a1, b1)};
+        std::vector<double> ub = {std::max(a0, b0), i == 0 ? lb.at(1) : std::max(a1, b1)};
+        if(i == 1)
+        {
+            lb.at(1) = 2;
+            ub.at(1) = 2;
+        }
+        else if(i == 2)
+        {
+            ub.at(0) = 1;
+            ub.at(1) = 2;
+        }
+        LB.row(i) << lb.at(0), lb.at(1);
+        UB.row(i) << ub.at(0), ub.at(1);
+
+        DenseVector lower, upper, tightLower, tightUpper;
+        bspline.bounds(lb, ub, lower, upper);
+        bspline.bounds(lb, ub, tightLower, tightUpper, true);
+
+        // Loose bounds are those of the control points of the basis functions that are nonzero on the box
+        if(i > 1)
+        {
+            DenseMatrix viewPoints = BSplineView(bspline).subdomain(lb, ub).getControlPoints().bottomRows(2);
+            if(lower != DenseVector(viewPoints.rowwise().minCoeff()) || upper != DenseVector(viewPoints.rowwise().maxCoeff()))
+            {
+                cout << "Test failed - check bounds from control points!" << endl;
+                return;
+            }
+
+            // Tight bounds are those of the control points after domain reduction
+            BSpline reduced = bspline;
+            reduced.reduceDomain(lb, ub);
+            DenseMatrix reducedPoints = reduced.getControlPoints().bottomRows(2);
+            if((tightLower - reducedPoints.rowwise().minCoeff()).cwiseAbs().maxCoeff() > 1e-10
+               || (tightUpper - reducedPoints.rowwise().maxCoeff()).cwiseAbs().maxCoeff() > 1e-10)
+            {
+                cout << "Test failed - check tightened bounds!" << endl;
+                return;
+            }
+        }
+
+        if((tightLower - lower).minCoeff() < -1e-12 || (upper - tightUpper).minCoeff() < -1e-12)
+        {
+            cout << "Test failed - tightened bounds are looser!" << endl;
+            return;
+        }
+
+        // The bounds hold on the box
+        for(unsigned int j = 0; j < 50; j++)
+        {
+            x << lb.at(0) + (ub.at(0) - lb.at(0))*uniform(generator), lb.at(1) + (ub.at(1) - lb.at(1))*uniform(generator);
+            DenseVector value = bspline.evalVector(x);
+            if((value - tightLower).minCoeff() < -1e-10 || (tightUpper - value).minCoeff() < -1e-10)
+            {
+                cout << "Test failed - check bounds on box!" << endl;
+                return;
+            }
+        }
+    }
+
+    // Batched bounds equal those of the boxes one by one
+    DenseMatrix lowerBatch, upperBatch;
+    bspline.boundsBatch(LB, UB, lowerBatch, upperBatch, true);
+    for(unsigned int i = 0; i < numBoxes; i++)
+    {
+        DenseVector lower, upper;
+        bspline.bounds({LB(i,0), LB(i,1)}, {UB(i,0), UB(i,1)}, lower, upper, true);
+        if(DenseVector(lowerBatch.row(i).transpose()) != lower || DenseVector(upperBatch.row(i).transpose()) != upper)
+        {
+            cout << "Test failed - check batched bounds!" << endl;
+            return;
+        }
+    }
+
+    cout << "Test finished successfully!" << endl;
+}
+
+void testBSplineMinimizer()
+{
+    cout << endl << endl;
+    cout << "Testing global minimization..." << endl;
+
+    // Cubic B-spline of the six-hump camelback function, with global minima near (0.0898, -0.7126) and (-0.0898, 0.7126)
+    DataTable samples;
+    DenseVector x(2);
+    for(auto x0 : linspace(-2, 2, 25))
+    {
+        for(auto x1 : linspace(-1, 1, 15))
+        {
+            x(0) = x0;
+            x(1) = x1;
+            samples.addSample(x, f(x));
+        }
+    }
+    BSpline bspline(samples, BSplineType::CUBIC_FREE);
+
+    BSplineMinimizer minimizer(bspline);
+    minimizer.setTolerance(1e-8);
+    if(!minimizer.minimize()
+       || minimizer.getLowerBound() > minimizer.getMinimum()
+       || minimizer.getMinimum() - minimizer.getLowerBound() > 1e-8
+       || std::abs(bspline.eval(minimizer.getMinimizer()) - minimizer.getMinimum()) > 1e-14
+       || std::abs(minimizer.getMinimum() + 1.0316) > 1e-2)
+    {
+        cout << "Test failed - check branch-and-bound!" << endl;
+        return;
+    }
+
+    // No grid point is better than the minimum
+    for(auto x0 : linspace(-2, 2, 201))
+    {
+        for(auto x1 : linspace(-1, 1, 101))
+        {
+            x(0) = x0;
+            x(1) = x1;
+            if(bspline.eval(x) < minimizer.getMinimum() - 1e-8)
+            {
+                cout << "Test failed - minimum is not global!" << endl;
+                return;
+            }
+        }
+    }
+
+    // The result does not depend on the number of threads
+    unsigned int numThreads = ThreadPool::getDefault().getNumThreads();
+
+    ThreadPool::setDefaultNumThreads(1);
+    BSplineMinimizer serial(bspline);
+    serial.setTolerance(1e-8);
+    serial.minimize();
+
+    ThreadPool::setDefaultNumThreads(3);
+    BSplineMinimizer parallel(bspline);
+    parallel.setTolerance(1e-8);
+    parallel.minimize();
+
+    ThreadPool::setDefaultNumThreads(numThreads);
+
+    if(serial.getMinimizer() != parallel.getMinimizer()
+       || serial.getMinimum() != parallel.getMinimum()
+       || serial.getLowerBound() != parallel.getLowerBound()
+       || serial.getNumNodes() != parallel.getNumNodes()
+       || serial.getMinimizer() != minimizer.getMinimizer())
+    {
+        cout << "Test failed - branch-and-bound is not deterministic!" << endl;
+        return;
+    }
+
+    cout << "Test finished successfully!" << endl;
+}
+
+void testKnotRefinement()
+{
+    cout << endl << endl;
+    cout << "Testing knot refinement..." << endl;
+
+    std::mt19937 generator(8);
+    std::uniform_real_distribution<double> uniform(0, 1);
+
+    for(unsigned int degree = 1; degree <= 4; degree++)
+    {
+        // Clamped knot vector with an interior knot of multiplicity degree
+        std::vector<double> knots(degree+1, 0.0);
+        for(unsigned int i = 1; i < 10; i++)
+            knots.push_back(i*i/100.0);
+        knots.insert(knots.end(), degree-1, 0.25);
+        std::sort(knots.begin(), knots.end());
+        knots.insert(knots.end(), degree+1, 1.0);
+
+        BSplineBasis1D basis(knots, degree, KnotVectorType::EXPLICIT);
+        DenseVector c = DenseVector::Random(basis.numBasisFunctions());
+
+        // Many knots at once, by refinement and by insertion (the new basis reproduces the old one)
+        BSplineBasis1D refined = basis, inserted = basis;
+        SparseMatrix A, B;
+        std::vector<double> newKnots;
+        for(unsigned int i = 0; i < 3000; i++)
+            newKnots.push_back(uniform(generator));
+
+        if(!refined.refineKnots(A, 2000) || refined.numBasisFunctions() != 2000 || A.rows() != 2000
+           || !inserted.insertKnots(B, newKnots) || B.rows() != basis.numBasisFunctions() + 3000)
+        {
+            cout << "Test failed - check knot refinement!" << endl;
+            return;
+        }
+
+        DenseVector cRefined = A*c, cInserted = B*c;
+        for(unsigned int i = 0; i < 100; i++)
+        {
+            double x = uniform(generator);
+            double y = basis.evaluate(x).dot(c);
+            if(std::abs(refined.evaluate(x).dot(cRefined) - y) > 1e-12
+               || std::abs(inserted.evaluate(x).dot(cInserted) - y) > 1e-12)
+            {
+                cout << "Test failed - refined basis differs from the original!" << endl;
+                return;
+            }
+        }
+    }
+
+    cout << "Test finished successfully!" << endl;
+}
+
+void testKnotRemoval()
+{
+    cout << endl << endl;
+    cout << "Testing knot removal..." << endl;
+
+    // Smooth functions sampled on a fine grid
+    DataTable samples;
+    DenseMatrix Y(60*40, 2);
+    DenseVector x(2);
+    unsigned int i = 0;
+    for(auto x0 : linspace(0, 3, 60))
+    {
+        for(auto x1 : linspace(0, 1, 40))
+        {
+            x(0) = x0;
+            x(1) = x1;
+            samples.addSample(x, std::sin(x0)*std::cos(3*x1));
+            Y(i,0) = std::sin(x0)*std::cos(3*x1);
+            Y(i,1) = std::exp(-x0*x1);
+            i++;
+        }
+    }
+
+    BSplineFitter fitter(samples, BSplineType::CUBIC_FREE);
+    BSpline bspline = fitter.refit(Y);
+
+    double tol = 1e-6, ratio;
+    BSpline compressed = bspline.removeKnots(tol, ratio);
+
+    if(ratio <= 1 || compressed.getNumControlPoints() >= bspline.getNumControlPoints()
+       || compressed.getNumOutputs() != 2 || compressed.getBasisDegrees() != bspline.getBasisDegrees()
+       || compressed.getDomainLowerBound() != bspline.getDomainLowerBound()
+       || compressed.getDomainUpperBound() != bspline.getDomainUpperBound())
+    {
+        cout << "Test failed - no knots were removed!" << endl;
+        return;
+    }
+
+    // The error bound holds for every output
+    std::mt19937 generator(5);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    for(unsigned int j = 0; j < 1000; j++)
+    {
+        x(0) = 3*uniform(generator);
+        x(1) = uniform(generator);
+        if((compressed.evalVector(x) - bspline.evalVector(x)).cwiseAbs().maxCoeff() > tol)
+        {
+            cout << "Test failed - removed knots change the B-spline by more than the tolerance!" << endl;
+            return;
+        }
+    }
+
+    // Nothing is removed that changes the B-spline
+    BSpline unchanged = bspline.removeKnots(0);
+    for(unsigned int j = 0; j < 100; j++)
+    {
+        x(0) = 3*uniform(generator);
+        x(1) = uniform(generator);
+        if((unchanged.evalVector(x) - bspline.evalVector(x)).cwiseAbs().maxCoeff() > 1e-12)
+        {
+            cout << "Test failed - check knot removal without tolerance!" << endl;
+            return;
+        }
+    }
+
+    cout << "Test finished successfully!" << endl;
+}
+
 void run_tests()
 {
     runExample();
 
     testSplineDerivative();
 
+    testSplineHessian();
+
+    testKnotIntervalLookup();
+
+    testPiecewisePolynomial();
+
+    testKnotInsertion();
+
+    testKnotRefinement();
+
+    testKnotRemoval();
+
+    testDomainReduction();
+
+    testBSplineView();
+
+    testBSplineBounds();
+
+    testBSplineMinimizer();
+
+    testKroneckerSolver();
+
+    testLinearSolvers();
+    testBSplineFitter();
+    testMultipleOutputs();
+    testSmoothingParameterSelection();
+    testLeastSquaresFitter();
+    testIncrementalLeastSquaresFit();
+
+    testBatchEvaluation();
+
+    testBSplineEvaluator();
+
     runRecursiveDomainReductionTest();
 
     cout << endl << endl;